@@ -0,0 +1,51 @@
+# Writes every file in SHADER_DIR into a header as constexpr strings keyed by "shaders/<name>",
+# so the game doesn't read shaders from the working directory at runtime.
+#
+#   cmake -DSHADER_DIR=<res/shaders> -DOUTPUT=<EmbeddedShaders.h> -P EmbedShaders.cmake
+
+file(GLOB shaderFiles RELATIVE ${SHADER_DIR} ${SHADER_DIR}/*)
+list(SORT shaderFiles)
+list(LENGTH shaderFiles shaderCount)
+
+set(entries "")
+foreach(name IN LISTS shaderFiles)
+    file(READ ${SHADER_DIR}/${name} source)
+    string(APPEND entries "    EmbeddedShader{ \"shaders/${name}\", R\"shader(${source})shader\" },\n")
+endforeach()
+
+set(content "// Generated by cmake/EmbedShaders.cmake from res/shaders, do not edit
+#pragma once
+
+#include <array>
+#include <string_view>
+
+struct EmbeddedShader
+{
+    std::string_view path;
+    std::string_view source;
+};
+
+inline constexpr std::array<EmbeddedShader, ${shaderCount}> embeddedShaders =
+{
+${entries}};
+
+constexpr const EmbeddedShader* findEmbeddedShader(std::string_view path)
+{
+    for (const auto& shader : embeddedShaders)
+    {
+        if (shader.path == path)
+        {
+            return &shader;
+        }
+    }
+    return nullptr;
+}
+")
+
+# Leave the header untouched when nothing changed so main.cpp isn't rebuilt
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} previous)
+endif()
+if(NOT "${previous}" STREQUAL "${content}")
+    file(WRITE ${OUTPUT} "${content}")
+endif()
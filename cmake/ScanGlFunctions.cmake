@@ -0,0 +1,47 @@
+# Lists the GL entry points the sources call, so startup resolves only those instead of the
+# whole of glad. Names are checked against glad.h so our own gl* helpers are skipped.
+#
+#   cmake -DSOURCES=<main.cpp> -DGLAD_HEADER=<glad.h> -DOUTPUT=<GlFunctions.h> -P ScanGlFunctions.cmake
+
+cmake_policy(SET CMP0057 NEW)
+
+file(STRINGS ${GLAD_HEADER} gladDefines REGEX "^#define gl[A-Z][A-Za-z0-9_]* glad_gl")
+set(known "")
+foreach(line IN LISTS gladDefines)
+    string(REGEX REPLACE "^#define (gl[A-Za-z0-9_]+) .*" "\\1" name "${line}")
+    list(APPEND known ${name})
+endforeach()
+
+set(used "")
+foreach(source IN LISTS SOURCES)
+    file(READ ${source} text)
+    string(REGEX MATCHALL "gl[A-Z][A-Za-z0-9_]*[ \t]*\\(" calls "${text}")
+    foreach(call IN LISTS calls)
+        string(REGEX REPLACE "[ \t]*\\($" "" name "${call}")
+        if(name IN_LIST known)
+            list(APPEND used ${name})
+        endif()
+    endforeach()
+endforeach()
+list(REMOVE_DUPLICATES used)
+list(SORT used)
+
+set(entries "")
+foreach(name IN LISTS used)
+    string(TOUPPER ${name} upper)
+    string(APPEND entries "    X(${name}, PFN${upper}PROC) \\\n")
+endforeach()
+
+set(content "// Generated by cmake/ScanGlFunctions.cmake from the sources, do not edit
+#pragma once
+
+#define GL_USED_FUNCTIONS(X) \\
+${entries}
+")
+
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} previous)
+endif()
+if(NOT "${previous}" STREQUAL "${content}")
+    file(WRITE ${OUTPUT} "${content}")
+endif()
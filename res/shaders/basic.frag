@@ -2,7 +2,23 @@
 
 out vec4 color;
 
+#ifdef INSTANCED
+in vec2 vs_position;
+flat in int vs_type;
+
+// Same order as PowerUpType
+const vec3 powerUpColors[2] = vec3[2](
+    vec3(0.2, 0.8, 1.0),
+    vec3(1.0, 0.8, 0.2)
+);
+#endif
+
 void main(void)
 {
+#ifdef INSTANCED
+    float glow = 1.0 - abs(vs_position.y) * 20.0;
+    color = vec4(powerUpColors[clamp(vs_type, 0, 1)] * (0.6 + 0.4 * glow), 1.0);
+#else
     color = vec4(0.0, 0.5, 0.4, 1.0);
-}
\ No newline at end of file
+#endif
+}
@@ -1,11 +1,24 @@
 #version 460 core
 
+#include "common.glsl"
+
 layout(location = 0) in vec2 position;
 
-uniform mat4 projectionMatrix;
-uniform mat4 modelMatrix;
+#ifdef INSTANCED
+layout(location = 1) in vec2 offset;
+layout(location = 2) in float type;
+
+out vec2 vs_position;
+flat out int vs_type;
+#endif
 
 void main(void)
 {
-    gl_Position = projectionMatrix * modelMatrix * vec4(position, 0.0, 1.0);
-}
\ No newline at end of file
+#ifdef INSTANCED
+    vs_position = position;
+    vs_type = int(type);
+    gl_Position = toClipSpace(position + offset);
+#else
+    gl_Position = toClipSpace(position, modelMatrix);
+#endif
+}
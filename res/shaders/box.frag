@@ -3,8 +3,28 @@
 out vec4 color;
 
 in vec2 vs_position;
+in vec2 vs_uv;
+flat in uint vs_state;
+
+layout(binding = 0) uniform sampler2DArray atlas;
+uniform int spriteLayer;
+
+// Same order as BrickMaterial
+const vec3 materialPalette[5] = vec3[5](
+    vec3(0.3, 0.5, 0.0),
+    vec3(0.2, 0.5, 0.8),
+    vec3(0.7, 0.7, 0.75),
+    vec3(0.25, 0.25, 0.25),
+    vec3(0.9, 0.35, 0.1)
+);
+const float materialHitPoints[5] = float[5](1.0, 2.0, 3.0, 15.0, 1.0);
 
 void main(void)
 {
-    color = vec4(vs_position.x + 0.3, 0.5, vs_position.y - 0.5, 1.0);
-}
\ No newline at end of file
+    uint material = min(vs_state >> 4u, 4u);
+    float health = float(vs_state & 0x0Fu) / materialHitPoints[material];
+
+    vec3 gradient = vec3(vs_position.x + 0.3, 0.5, vs_position.y - 0.5) * 0.3;
+    vec3 texel = texture(atlas, vec3(vs_uv, spriteLayer)).rgb;
+    color = vec4(materialPalette[material] * texel * (0.4 + 0.6 * health) + gradient, 1.0);
+}
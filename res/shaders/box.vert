@@ -1,14 +1,33 @@
 #version 460 core
 
+#include "common.glsl"
+
 layout(location = 0) in vec2 position;
 
-out vec2 vs_position;
+layout(std430, binding = 0) readonly buffer BrickStates
+{
+    uint brickStates[];
+};
+
+uniform vec4 spriteRect;
 
-uniform mat4 projectionMatrix;
+out vec2 vs_position;
+out vec2 vs_uv;
+flat out uint vs_state;
 
 void main(void)
 {
+    // Four vertices per brick, four state bytes per uint
+    uint brick = uint(gl_VertexID) / 4u;
+    vs_state = (brickStates[brick / 4u] >> ((brick % 4u) * 8u)) & 0xFFu;
+
     vs_position = position;
-    gl_Position = projectionMatrix * vec4(position, 0.0, 1.0);
-}
+    vs_uv = spriteUv(spriteRect);
+    gl_Position = toClipSpace(position);
 
+    // Destroyed bricks collapse into a degenerate quad
+    if ((vs_state & 0x0Fu) == 0u)
+    {
+        gl_Position = vec4(0.0, 0.0, 0.0, 0.0);
+    }
+}
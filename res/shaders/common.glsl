@@ -0,0 +1,22 @@
+// Shared vertex plumbing, the matrices are uploaded by Shader::setProjectionMatrix and
+// Shader::setModelMatrix
+uniform mat4 projectionMatrix;
+uniform mat4 modelMatrix;
+
+vec4 toClipSpace(vec2 position)
+{
+    return projectionMatrix * vec4(position, 0.0, 1.0);
+}
+
+vec4 toClipSpace(vec2 position, mat4 model)
+{
+    return projectionMatrix * model * vec4(position, 0.0, 1.0);
+}
+
+// Atlas coordinates for the current corner, quads list their vertices as top left, bottom
+// left, bottom right, top right. rect holds the region's u0, v0, u1, v1.
+vec2 spriteUv(vec4 rect)
+{
+    const vec2 corners[4] = vec2[4](vec2(0.0, 1.0), vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0));
+    return mix(rect.xy, rect.zw, corners[gl_VertexID % 4]);
+}
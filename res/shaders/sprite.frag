@@ -0,0 +1,13 @@
+#version 460 core
+
+out vec4 color;
+
+in vec2 vs_uv;
+
+layout(binding = 0) uniform sampler2DArray atlas;
+uniform int spriteLayer;
+
+void main(void)
+{
+    color = texture(atlas, vec3(vs_uv, spriteLayer));
+}
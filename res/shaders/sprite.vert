@@ -0,0 +1,15 @@
+#version 460 core
+
+#include "common.glsl"
+
+layout(location = 0) in vec2 position;
+
+uniform vec4 spriteRect;
+
+out vec2 vs_uv;
+
+void main(void)
+{
+    vs_uv = spriteUv(spriteRect);
+    gl_Position = toClipSpace(position, modelMatrix);
+}
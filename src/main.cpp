@@ -2,6 +2,9 @@
 #   define WIN32_LEAN_AND_MEAN
 #   define NOMINMAX
 #   include <Windows.h>
+#   include <psapi.h>
+#elif defined(__GLIBC__)
+#   include <malloc.h>
 #endif
 
 #include "glad/glad.h"
@@ -9,6 +12,7 @@
 
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <AL/alext.h>
 #include <sndfile.h>
 
 
@@ -24,6 +28,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "EmbeddedShaders.h"
+#include "SpriteAtlas.h"
+#include "GlFunctions.h"
+
 using Vec2 = glm::vec2;
 using Mat4 = glm::mat4;
 
@@ -32,6 +40,27 @@ template<typename T> using Scoped = std::unique_ptr<T>;
 
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <bit>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstddef>
+#include <coroutine>
+#include <exception>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <future>
+#include <unordered_map>
+#include <cctype>
+#include <utility>
 
 using namespace std::string_literals;
 
@@ -74,6 +103,8 @@ template<RefCounted T>
 class RefCnt
 {
 private:
+    template<RefCounted U> friend class RefCnt;
+
     T* object{};
 
     RefCnt(T* object) 
@@ -99,18 +130,23 @@ public:
     RefCnt(const RefCnt<T>& other)
         : object(other.object)
     {
-        object->addRef();
+        if (object)
+        {
+            object->addRef();
+        }
     }
 
     RefCnt& operator=(const RefCnt<T>& other)
     {
-
+        if (other.object)
+        {
+            other.object->addRef();
+        }
         if (object)
         {
             object->release();
         }
         object = other.object;
-        object->addRef();
         return *this;
     }
 
@@ -120,6 +156,17 @@ public:
         other.object = nullptr;
     }
 
+    // Upcast from a reference to a derived type
+    template<RefCounted U> requires std::is_convertible_v<U*, T*>
+    RefCnt(const RefCnt<U>& other)
+        :   object(other.object)
+    {
+        if (object)
+        {
+            object->addRef();
+        }
+    }
+
     RefCnt& operator=(RefCnt<T>&& other) noexcept
     {
         if (object)
@@ -150,6 +197,11 @@ public:
     {
         return object;
     }
+
+    const T* get() const
+    {
+        return object;
+    }
 };
 
 template<typename T> using Ref = RefCnt<T>;
@@ -175,6 +227,10 @@ public:
     {
         SF_INFO info = {};
         SNDFILE* file = sf_open(filePath.data(), SFM_READ, &info);
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open audio file: "s + std::string(filePath));
+        }
 
         // Read data
         std::array<short, 4096> data;
@@ -242,8 +298,11 @@ private:
     ALuint buffer{ 0 };
 public:
     AudioEntry(std::string_view file)
+        :   AudioEntry(AudioFile(file))
+    {}
+
+    AudioEntry(const AudioFile& audioFile)
     {
-        AudioFile audioFile(file);
         alGenBuffers(1, &buffer);
         alBufferData(buffer, audioFile.getChannels() == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
             audioFile.getData(), static_cast<ALsizei>(audioFile.getSize()), audioFile.getSampleRate());
@@ -294,6 +353,7 @@ class AudioSource : public IRefCounted
 private:
     ALuint source{ 0 };
     ALuint currentBuffer{ 0 };
+    float currentGain{ 1.0f };
 
 public:
     AudioSource()
@@ -338,7 +398,8 @@ public:
         return *this;
     }
 
-    void playSound(const Ref<AudioEntry>& entry)
+    // Applies buffer and gain without starting playback, see AudioBatch
+    void prepare(const Ref<AudioEntry>& entry, float gain = 1.0f)
     {
         if (currentBuffer != entry->getBuffer())
         {
@@ -346,714 +407,7081 @@ public:
             alSourcef(source, AL_PITCH, 1.0f);
             currentBuffer = entry->getBuffer();
         }
+        if (currentGain != gain)
+        {
+            alSourcef(source, AL_GAIN, gain);
+            currentGain = gain;
+        }
+    }
+
+    void playSound(const Ref<AudioEntry>& entry, float gain = 1.0f)
+    {
+        prepare(entry, gain);
         alSourcePlay(source);
     }
-};
-#pragma endregion AUDIO SYSTEM
 
+    inline ALuint getSource() const
+    {
+        return source;
+    }
+};
 
 // -------------------------------------------------------------------------------------------
-// ----------------------------- GRAPHICS PRIMITIVES -----------------------------------------
-// -------------------------------------------------------------------------------------------
-#pragma region GRAPHICS PRIMITIVES
-class Shader : public IRefCounted
+// Holds back source changes for the lifetime of the object so the mixer applies them all at
+// once instead of taking its lock per call. Uses AL_SOFT_deferred_updates when available and
+// falls back to suspending the context.
+class AudioBatch
 {
 private:
-    GLuint id{ 0 };
-
-    GLint projectionMatrix{ 0 };
-    GLint modelMatrix{ 0 };
-
-public:
-    Shader(std::string_view vertFile, std::string_view fragFile)
+    struct Functions
     {
-        id = glCreateProgram();
-        GLuint vs = compileShader(GL_VERTEX_SHADER, vertFile);
-        GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragFile);
-
-        glAttachShader(id, vs);
-        glAttachShader(id, fs);
-
-        glLinkProgram(id);
-        glValidateProgram(id);
-
-        glDetachShader(id, fs);
-        glDetachShader(id, vs);
-
-        glDeleteShader(fs);
-        glDeleteShader(vs);
-
-        projectionMatrix = glGetUniformLocation(id, "projectionMatrix");
-        modelMatrix = glGetUniformLocation(id, "modelMatrix");
-    }
+        LPALDEFERUPDATESSOFT defer{ nullptr };
+        LPALPROCESSUPDATESSOFT process{ nullptr };
+    };
 
-    ~Shader()
+    static const Functions& getFunctions()
     {
-        if (id)
+        static const Functions functions = []
         {
-            glDeleteProgram(id);
-        }
+            Functions result;
+            if (alIsExtensionPresent("AL_SOFT_deferred_updates"))
+            {
+                result.defer = reinterpret_cast<LPALDEFERUPDATESSOFT>(alGetProcAddress("alDeferUpdatesSOFT"));
+                result.process = reinterpret_cast<LPALPROCESSUPDATESSOFT>(alGetProcAddress("alProcessUpdatesSOFT"));
+            }
+            if (!result.defer || !result.process)
+            {
+                result = {};
+            }
+            return result;
+        }();
+        return functions;
     }
 
-    Shader(const Shader&) = delete;
-    Shader& operator=(const Shader&) = delete;
+    ALCcontext* suspended{ nullptr };
 
-    Shader(Shader&& other) noexcept
+public:
+    AudioBatch()
     {
-        if (id)
+        const Functions& functions = getFunctions();
+        if (functions.defer)
         {
-            glDeleteProgram(id);
+            functions.defer();
         }
-
-        id = other.id;
-        other.id = 0;
-    }
-
-    Shader& operator=(Shader&& other) noexcept
-    {
-        if (id)
+        else
         {
-            glDeleteProgram(id);
+            suspended = alcGetCurrentContext();
+            alcSuspendContext(suspended);
         }
-
-        id = other.id;
-        other.id = 0;
-        return *this;
     }
 
-    GLuint compileShader(GLenum type, std::string_view file)
+    ~AudioBatch()
     {
-        std::ifstream f(file.data(), std::ios::ate | std::ios::badbit);
-        size_t size = f.tellg();
-        f.seekg(0);
-        std::vector<char> src(size);
-        f.read(src.data(), size);
-        f.close();
-
-        GLuint shaderId = glCreateShader(type);
-        const char* srcCstr = src.data();
-        glShaderSource(shaderId, 1, &srcCstr, nullptr);
-
-        int result = 0;
-        glCompileShader(shaderId);
-        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &result);
-        if (!result)
+        if (suspended)
         {
-            int shaderLogLength = 0;
-            glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &shaderLogLength);
-            std::string log;
-            log.resize(shaderLogLength);
-            glGetShaderInfoLog(shaderId, shaderLogLength, &shaderLogLength, log.data());
-
-            throw std::runtime_error("Failed to compile shader: "s + log);
+            alcProcessContext(suspended);
+        }
+        else
+        {
+            getFunctions().process();
         }
-
-        return shaderId;
-    }
-
-    GLuint getId() const
-    {
-        return id;
-    }
-
-    void setProjectionMatrix(const Mat4& mat)
-    {
-        setUniform(projectionMatrix, mat);
     }
 
-    void setModelMatrix(const Mat4& mat)
-    {
-        setUniform(modelMatrix, mat);
-    }
+    AudioBatch(const AudioBatch&) = delete;
+    AudioBatch& operator=(const AudioBatch&) = delete;
 
-private:
-    void setUniform(GLint location, const Mat4& mat)
+    static bool isDeferred()
     {
-        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+        return getFunctions().defer != nullptr;
     }
 };
 
 // -------------------------------------------------------------------------------------------
-struct Vertex
+enum class Waveform : uint8_t
 {
-    Vertex(Vec2 position)
-        : position(position)
-    {}
-
-    Vec2 position;
+    Sine,
+    Triangle,
+    Square,
+    Saw
 };
 
-void APIENTRY glCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+struct SynthPatch
 {
-    std::cout << "OpenGL debug message: " << message << std::endl;
-}
+    Waveform waveform{ Waveform::Sine };
+    float frequency{ 440.0f };
 
-// -------------------------------------------------------------------------------------------
-class Buffer : public IRefCounted
+    // 0 is the plain oscillator, 1 is plain noise
+    float noise{ 0.0f };
+
+    // Envelope in seconds, hold is the time spent at the sustain level before the release
+    float attack{ 0.002f };
+    float decay{ 0.05f };
+    float sustain{ 0.3f };
+    float hold{ 0.0f };
+    float release{ 0.08f };
+
+    float gain{ 0.5f };
+};
+
+// Renders oscillator + noise voices shaped by an ADSR envelope, no stored PCM. Samples are
+// produced in fixed blocks by branch-free loops without carried state (phase, envelope and
+// noise are all computed from the sample index) so the compiler vectorizes them. Triggers
+// come in through a single producer, single consumer ring so render() can run on the mixer thread.
+class VoiceBank
 {
+public:
+    static constexpr size_t maxVoices = 32;
+    static constexpr size_t blockFrames = 64;
+
 private:
-    GLuint id{ 0 };
-    GLenum kind{ 0 };
-    GLenum usage{ 0 };
+    static constexpr uint32_t triggerCapacity = 64;
 
-    size_t capacity{ 0 };
-    size_t size{ 0 };
+    struct Voice
+    {
+        Waveform waveform;
+        float gain;
+        float noise;
+        float sustain;
+        float phase;
+        float phaseStep;
+        float attackStep;
+        float attackEnd;
+        float decayStep;
+        float releaseStart;
+        float releaseStep;
+        uint32_t end;
+        uint32_t time;
+        uint32_t seed;
+        bool active;
+    };
 
-public:
-    template<typename T>
-    Buffer(GLenum kind, GLenum usage, const std::vector<T>& data)
-        : kind(kind), usage(usage)
+    int sampleRate;
+    std::array<Voice, maxVoices> voices{};
+    uint32_t nextSeed{ 0x9E3779B9u };
+
+    std::array<SynthPatch, triggerCapacity> triggers{};
+    std::atomic<uint32_t> triggerHead{ 0 };
+    std::atomic<uint32_t> triggerTail{ 0 };
+
+    static float oscillate(Waveform waveform, float phase)
     {
-        glCreateBuffers(1, &id);
-        if (id == 0)
+        switch (waveform)
         {
-            throw std::runtime_error("Failed to create buffer");
+        case Waveform::Triangle:
+            return 1.0f - 4.0f * std::abs(phase - 0.5f);
+        case Waveform::Square:
+            return phase < 0.5f ? 1.0f : -1.0f;
+        case Waveform::Saw:
+            return 2.0f * phase - 1.0f;
+        default:
+        {
+            // Parabolic sine with one refinement step, max error around 0.1%
+            float x = 2.0f * phase - 1.0f;
+            float y = 4.0f * x * (1.0f - std::abs(x));
+            return 0.225f * (y * std::abs(y) - y) + y;
+        }
         }
+    }
 
-        glNamedBufferData(id, data.size() * sizeof T, data.data(), usage);
+    static uint32_t hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
     }
 
-    Buffer(GLenum kind, GLenum usage, size_t size)
-        :   capacity(size)
+    template<Waveform W>
+    static void renderVoice(Voice& voice, float* out, size_t frames)
     {
-        glCreateBuffers(1, &id);
-        if (id == 0)
+        const float base = static_cast<float>(voice.time);
+        for (size_t i = 0; i < frames; i++)
         {
-            throw std::runtime_error("Failed to create buffer");
-        }
+            float t = base + static_cast<float>(i);
+            float phase = voice.phase + voice.phaseStep * static_cast<float>(i);
+            phase -= std::floor(phase);
 
-        glNamedBufferStorage(id, static_cast<GLsizeiptr>(size), nullptr, usage);
-    }
+            float osc = oscillate(W, phase);
+            float noise = static_cast<float>(hash(voice.seed + voice.time + static_cast<uint32_t>(i)) >> 8) * (2.0f / 16777216.0f) - 1.0f;
 
-    template<typename T> void batch(const std::vector<T>& data)
-    {
-        assert(size + data.size() * sizeof T < capacity);
-        glNamedBufferSubData(id, size, static_cast<GLsizeiptr>(data.size() * sizeof T), data.data());
+            float attack = std::min(t * voice.attackStep, 1.0f);
+            float decay = 1.0f - (1.0f - voice.sustain) * std::clamp((t - voice.attackEnd) * voice.decayStep, 0.0f, 1.0f);
+            float release = std::clamp(1.0f - (t - voice.releaseStart) * voice.releaseStep, 0.0f, 1.0f);
+
+            out[i] += voice.gain * attack * decay * release * (osc + (noise - osc) * voice.noise);
+        }
+
+        voice.phase += voice.phaseStep * static_cast<float>(frames);
+        voice.phase -= std::floor(voice.phase);
+        voice.time += static_cast<uint32_t>(frames);
+        voice.active = voice.time < voice.end;
     }
 
-    ~Buffer()
+    void start(const SynthPatch& patch)
     {
-        if (id)
+        // Steal the oldest voice when all are busy, that keeps the cost per block bounded
+        Voice* target = &voices[0];
+        for (auto& voice : voices)
         {
-            glDeleteBuffers(1, &id);
+            if (!voice.active)
+            {
+                target = &voice;
+                break;
+            }
+            if (voice.time > target->time)
+            {
+                target = &voice;
+            }
         }
+
+        float rate = static_cast<float>(sampleRate);
+        float attackSamples = std::max(patch.attack * rate, 1.0f);
+        float decaySamples = std::max(patch.decay * rate, 1.0f);
+        float releaseSamples = std::max(patch.release * rate, 1.0f);
+
+        Voice& voice = *target;
+        voice.waveform = patch.waveform;
+        voice.gain = patch.gain;
+        voice.noise = std::clamp(patch.noise, 0.0f, 1.0f);
+        voice.sustain = patch.sustain;
+        voice.phase = 0.0f;
+        voice.phaseStep = patch.frequency / rate;
+        voice.attackStep = 1.0f / attackSamples;
+        voice.attackEnd = attackSamples;
+        voice.decayStep = 1.0f / decaySamples;
+        voice.releaseStart = attackSamples + decaySamples + patch.hold * rate;
+        voice.releaseStep = 1.0f / releaseSamples;
+        voice.end = static_cast<uint32_t>(voice.releaseStart + releaseSamples);
+        voice.time = 0;
+        voice.seed = nextSeed;
+        voice.active = true;
+        nextSeed = hash(nextSeed);
     }
 
-    Buffer(const Buffer&) = delete;
-    Buffer& operator=(const Buffer&) = delete;
+public:
+    VoiceBank(int sampleRate)
+        :   sampleRate(sampleRate)
+    {}
 
-    Buffer(Buffer&& other) noexcept
-        : kind(other.kind),
-        usage(other.usage)
+    VoiceBank(const VoiceBank&) = delete;
+    VoiceBank& operator=(const VoiceBank&) = delete;
+
+    // Producer side, returns false when the ring is full and the trigger was dropped
+    bool trigger(const SynthPatch& patch)
     {
-        if (id)
+        uint32_t tail = triggerTail.load(std::memory_order_relaxed);
+        if (tail - triggerHead.load(std::memory_order_acquire) == triggerCapacity)
         {
-            glDeleteBuffers(1, &id);
+            return false;
         }
-        id = other.id;
-        other.id = 0;
+        triggers[tail % triggerCapacity] = patch;
+        triggerTail.store(tail + 1, std::memory_order_release);
+        return true;
     }
 
-    Buffer& operator=(Buffer&& other) noexcept
+    // Consumer side, overwrites out with mono float samples
+    void render(float* out, size_t frames)
     {
-        if (id)
+        uint32_t head = triggerHead.load(std::memory_order_relaxed);
+        uint32_t tail = triggerTail.load(std::memory_order_acquire);
+        for (; head != tail; head++)
         {
-            glDeleteBuffers(1, &id);
+            start(triggers[head % triggerCapacity]);
+        }
+        triggerHead.store(head, std::memory_order_release);
+
+        std::fill(out, out + frames, 0.0f);
+        for (size_t offset = 0; offset < frames; offset += blockFrames)
+        {
+            size_t count = std::min(blockFrames, frames - offset);
+            for (auto& voice : voices)
+            {
+                if (!voice.active)
+                {
+                    continue;
+                }
+
+                switch (voice.waveform)
+                {
+                case Waveform::Sine: renderVoice<Waveform::Sine>(voice, out + offset, count); break;
+                case Waveform::Triangle: renderVoice<Waveform::Triangle>(voice, out + offset, count); break;
+                case Waveform::Square: renderVoice<Waveform::Square>(voice, out + offset, count); break;
+                case Waveform::Saw: renderVoice<Waveform::Saw>(voice, out + offset, count); break;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < frames; i++)
+        {
+            out[i] = std::clamp(out[i], -1.0f, 1.0f);
         }
-        id = other.id;
-        other.id = 0;
-        return *this;
     }
 
-    GLuint getId() const
+    size_t getActiveCount() const
     {
-        return id;
+        return static_cast<size_t>(std::count_if(voices.begin(), voices.end(), [](const Voice& voice) { return voice.active; }));
     }
 
-    GLenum getType() const
+    inline int getSampleRate() const
     {
-        return kind;
+        return sampleRate;
     }
 };
 
-
 // -------------------------------------------------------------------------------------------
-class VertexArray : public IRefCounted
+// Plays a VoiceBank on one AL source. With AL_SOFT_callback_buffer the mixer pulls samples
+// straight from the bank, otherwise update() keeps a small queue of streaming buffers filled.
+class Synthesizer : public IRefCounted
 {
 private:
-    GLuint id{ 0 };
+    static constexpr size_t streamBufferCount = 4;
+    static constexpr size_t streamFrames = 512;
 
-public:
-    struct LayoutElem
-    {
-        GLuint index{ 0 };
-        GLenum count{ 0 };
-        GLenum format{ 0 };
-        bool normalized{ false };
-        size_t stride{ 0 };
-        size_t offset{ 0 };
-    };
+    Scoped<VoiceBank> bank;
+    ALuint source{ 0 };
+    ALuint callbackBuffer{ 0 };
+    std::array<ALuint, streamBufferCount> streamBuffers{};
+    std::vector<float> scratch;
+    std::vector<short> pcm;
 
-    VertexArray()
+#ifdef AL_SOFT_callback_buffer
+    static ALsizei AL_APIENTRY fill(ALvoid* userData, ALvoid* samples, ALsizei bytes) noexcept
     {
-        glCreateVertexArrays(1, &id);
+        static_cast<VoiceBank*>(userData)->render(static_cast<float*>(samples), static_cast<size_t>(bytes) / sizeof(float));
+        return bytes;
     }
 
-    ~VertexArray()
+    bool startCallback()
     {
-        if (id)
+        if (!alIsExtensionPresent("AL_SOFT_callback_buffer"))
         {
-            glDeleteVertexArrays(1, &id);
+            return false;
         }
-    }
-
-    VertexArray(const VertexArray&) = delete;
-    VertexArray& operator=(const VertexArray&) = delete;
 
-    VertexArray(VertexArray&& other) noexcept
-    {
-        if (id)
+        auto bufferCallback = reinterpret_cast<LPALBUFFERCALLBACKSOFT>(alGetProcAddress("alBufferCallbackSOFT"));
+        if (!bufferCallback)
         {
-            glDeleteVertexArrays(1, &id);
+            return false;
         }
-        id = other.id;
-        other.id = 0;
+
+        alGenBuffers(1, &callbackBuffer);
+        bufferCallback(callbackBuffer, AL_FORMAT_MONO_FLOAT32, bank->getSampleRate(), &Synthesizer::fill, bank.get());
+        alSourcei(source, AL_BUFFER, static_cast<ALint>(callbackBuffer));
+        alSourcePlay(source);
+        return true;
+    }
+#else
+    bool startCallback()
+    {
+        return false;
     }
+#endif
 
-    VertexArray& operator=(VertexArray&& other) noexcept
+    void refill(ALuint buffer)
     {
-        if (id)
+        bank->render(scratch.data(), streamFrames);
+        for (size_t i = 0; i < streamFrames; i++)
         {
-            glDeleteVertexArrays(1, &id);
+            pcm[i] = static_cast<short>(scratch[i] * 32767.0f);
         }
-        id = other.id;
-        other.id = id;
-        return *this;
+        alBufferData(buffer, AL_FORMAT_MONO16, pcm.data(), static_cast<ALsizei>(pcm.size() * sizeof(short)), bank->getSampleRate());
     }
 
-    void bindLayout(const std::vector<LayoutElem> elems)
+public:
+    Synthesizer()
     {
-        for (const auto& elem : elems)
-        {
-            glEnableVertexArrayAttrib(id, elem.index);
+        ALCint frequency = 44100;
+        alcGetIntegerv(alcGetContextsDevice(alcGetCurrentContext()), ALC_FREQUENCY, 1, &frequency);
+        bank = std::make_unique<VoiceBank>(frequency);
 
-            glVertexArrayAttribFormat(
-                id,
-                elem.index,
-                elem.count,
-                elem.format,
-                elem.normalized,
-                static_cast<GLuint>(elem.offset)
-            );
+        alGenSources(1, &source);
+        if (startCallback())
+        {
+            return;
+        }
 
-            glVertexArrayAttribBinding(id, elem.index, 0);
+        scratch.resize(streamFrames);
+        pcm.resize(streamFrames);
+        alGenBuffers(static_cast<ALsizei>(streamBuffers.size()), streamBuffers.data());
+        for (ALuint buffer : streamBuffers)
+        {
+            refill(buffer);
         }
+        alSourceQueueBuffers(source, static_cast<ALsizei>(streamBuffers.size()), streamBuffers.data());
+        alSourcePlay(source);
     }
 
-    void bindVertexBuffer(const Buffer* pBuffer)
+    ~Synthesizer()
     {
-        glVertexArrayVertexBuffer(id, 0, pBuffer->getId(), 0, sizeof Vertex);
+        // Stopping first guarantees the mixer is done calling back into the bank
+        alSourceStop(source);
+        alSourcei(source, AL_BUFFER, 0);
+        alDeleteSources(1, &source);
+        if (callbackBuffer)
+        {
+            alDeleteBuffers(1, &callbackBuffer);
+        }
+        if (streamBuffers[0])
+        {
+            alDeleteBuffers(static_cast<ALsizei>(streamBuffers.size()), streamBuffers.data());
+        }
     }
 
-    void bindIndexBuffer(const Buffer* pBuffer)
-    {
-        glVertexArrayElementBuffer(id, pBuffer->getId());
-    }
+    Synthesizer(const Synthesizer&) = delete;
+    Synthesizer& operator=(const Synthesizer&) = delete;
 
-    GLuint getId() const
+    bool trigger(const SynthPatch& patch)
     {
-        return id;
+        return bank->trigger(patch);
     }
-};
-#pragma endregion GRAPHICS PRIMITIVES
-
-// -------------------------------------------------------------------------------------------
-// ----------------------------- GAME OBJECTS ------------------------------------------------
-// -------------------------------------------------------------------------------------------
-#pragma region GAME OBJECTS
-class Quad : public IRefCounted
-{
-    Ref<VertexArray> vao;
-    Ref<Buffer> vbo;
-    Ref<Buffer> ibo;
-    Ref<Shader> shader;
-
-    Vec2 position{ 0.0f, -0.5f };
-    Vec2 size{ 1.0f, 0.2f };
 
-public:
-    Quad(Vec2 position, Vec2 size, std::string_view vs, std::string_view fs)
-        : position(position), size(size)
+    // Once per frame, only does work in the streaming fallback
+    void update()
     {
-        std::vector<Vertex> vertices =
+        if (callbackBuffer)
         {
-            Vertex({position.x - size.x / 2, position.y + size.y / 2}),
-            Vertex({position.x - size.x / 2, position.y - size.y / 2}),
-            Vertex({position.x + size.x / 2, position.y - size.y / 2}),
-            Vertex({position.x + size.x / 2, position.y + size.y / 2}),
-        };
+            return;
+        }
 
-        std::vector<GLuint> indices =
+        ALint processed = 0;
+        alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+        while (processed-- > 0)
         {
-            0,1,3,3,1,2
-        };
-
-        vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_STATIC_DRAW, vertices);
-        ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
-
-        vao = Ref<VertexArray>::make();
-
-        std::vector<VertexArray::LayoutElem> layout = {
-            {0, 2, GL_FLOAT, false, sizeof(Vertex), 0}
-        };
-
-        vao->bindVertexBuffer(vbo.get());
-        vao->bindIndexBuffer(ibo.get());
-        vao->bindLayout(layout);
+            ALuint buffer = 0;
+            alSourceUnqueueBuffers(source, 1, &buffer);
+            refill(buffer);
+            alSourceQueueBuffers(source, 1, &buffer);
+        }
 
-        shader = Ref<Shader>::make(vs, fs);
+        // Restart after an underrun, e.g. when a frame took longer than the queued audio
+        ALint state = 0;
+        alGetSourcei(source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING)
+        {
+            alSourcePlay(source);
+        }
     }
 
-    void draw(const Mat4& projection)
+    bool usesCallback() const
     {
-        Mat4 modelMatrix = glm::identity<Mat4>();
-        modelMatrix = glm::translate(modelMatrix, glm::vec3(position, 1.0f));
-
-        glBindVertexArray(vao->getId());
-        glUseProgram(shader->getId());
-        shader->setProjectionMatrix(projection);
-        shader->setModelMatrix(modelMatrix);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+        return callbackBuffer != 0;
     }
 
-    Vec2 getSize() const
+    inline ALuint getSource() const
     {
-        return size;
+        return source;
     }
 
-    Vec2 getPosition() const
+    // Audio already rendered and queued ahead of the play position, a new trigger waits for it
+    double getPendingSeconds() const
     {
-        return position;
+        if (callbackBuffer)
+        {
+            return 0.0;
+        }
+
+        ALint queued = 0;
+        ALfloat offset = 0.0f;
+        alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+        alGetSourcef(source, AL_SEC_OFFSET, &offset);
+        return std::max(static_cast<double>(queued) * streamFrames / bank->getSampleRate() - offset, 0.0);
     }
+};
 
-    void moveX(float amount)
-    {
-        float clamp = 2.0f - (size.x / 2.0f);
+// -------------------------------------------------------------------------------------------
+// 0 leaves the choice to the driver. There is no ALC attribute for the period size, OpenAL
+// derives it as frequency / refresh, so a higher refresh means smaller mixing periods.
+struct AudioDeviceSettings
+{
+    int frequency{ 0 };
+    int refresh{ 0 };
 
-        position.x += amount;
-        position.x = glm::clamp(position.x, -clamp, clamp);
+    std::vector<ALCint> getAttributes() const
+    {
+        std::vector<ALCint> attributes;
+        if (frequency > 0)
+        {
+            attributes.insert(attributes.end(), { ALC_FREQUENCY, frequency });
+        }
+        if (refresh > 0)
+        {
+            attributes.insert(attributes.end(), { ALC_REFRESH, refresh });
+        }
+        attributes.push_back(0);
+        return attributes;
     }
 
-    void moveY(float amount)
+    static AudioDeviceSettings query(ALCdevice* device)
     {
-        float clamp = 1.5f - (size.y / 2.0f);
-
-        position.y += amount;
-        position.y = glm::clamp(position.y, -clamp - 1.0f, clamp);
+        AudioDeviceSettings actual;
+        alcGetIntegerv(device, ALC_FREQUENCY, 1, &actual.frequency);
+        alcGetIntegerv(device, ALC_REFRESH, 1, &actual.refresh);
+        return actual;
     }
 };
 
-class PlayerPlatform : public IRefCounted
+struct LatencyDistribution
+{
+    size_t count{ 0 };
+    float p50{ 0.0f };
+    float p95{ 0.0f };
+    float p99{ 0.0f };
+    float max{ 0.0f };
+};
+
+// Measures how long a started sound takes to reach the output. AL_SOFT_source_latency gives
+// the time until the sample at the current source offset is heard, which right after a start
+// is the mixer plus device latency; audio queued ahead of the source is passed in by the caller.
+class AudioLatencyProbe
 {
 private:
-    Quad quad;
+    LPALGETSOURCEDVSOFT getSourcedv{ nullptr };
+    LPALCGETINTEGER64VSOFT getInteger64v{ nullptr };
+    ALCdevice* device{ nullptr };
+    std::vector<float> samples;
 
 public:
-    PlayerPlatform(Vec2 position, Vec2 size)
-        : quad(position, size, "shaders/basic.vert", "shaders/basic.frag")
+    AudioLatencyProbe()
     {
+        ALCcontext* context = alcGetCurrentContext();
+        device = context ? alcGetContextsDevice(context) : nullptr;
+        if (!device)
+        {
+            return;
+        }
+
+        if (alIsExtensionPresent("AL_SOFT_source_latency"))
+        {
+            getSourcedv = reinterpret_cast<LPALGETSOURCEDVSOFT>(alGetProcAddress("alGetSourcedvSOFT"));
+        }
+        if (alcIsExtensionPresent(device, "ALC_SOFT_device_clock"))
+        {
+            getInteger64v = reinterpret_cast<LPALCGETINTEGER64VSOFT>(alcGetProcAddress(device, "alcGetInteger64vSOFT"));
+        }
+        samples.reserve(4096);
     }
 
-    void draw(const Mat4& projection)
+    bool isAvailable() const
     {
-        quad.draw(projection);
+        return getSourcedv != nullptr;
     }
 
-    void move(float direction, float speed)
+    void measure(ALuint source, double aheadSeconds = 0.0)
     {
-        quad.moveX(direction * speed);
+        if (!getSourcedv)
+        {
+            return;
+        }
+
+        ALdouble offsetLatency[2] = {};
+        getSourcedv(source, AL_SEC_OFFSET_LATENCY_SOFT, offsetLatency);
+        samples.push_back(static_cast<float>((aheadSeconds + offsetLatency[1]) * 1000.0));
     }
 
-    Vec2 getPosition() const
+    // Output latency of the device itself, -1 without ALC_SOFT_device_clock
+    double getDeviceLatencyMs() const
     {
-        return quad.getPosition();
+        if (!getInteger64v)
+        {
+            return -1.0;
+        }
+
+        ALCint64SOFT nanoseconds = 0;
+        getInteger64v(device, ALC_DEVICE_LATENCY_SOFT, 1, &nanoseconds);
+        return static_cast<double>(nanoseconds) / 1e6;
     }
 
-    Vec2 getSize() const
+    // Distribution of the samples since the last call in milliseconds
+    LatencyDistribution takeDistribution()
     {
-        return quad.getSize();
+        LatencyDistribution result;
+        if (samples.empty())
+        {
+            return result;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        auto at = [this](float fraction) { return samples[static_cast<size_t>(fraction * (samples.size() - 1))]; };
+        result.count = samples.size();
+        result.p50 = at(0.50f);
+        result.p95 = at(0.95f);
+        result.p99 = at(0.99f);
+        result.max = samples.back();
+        samples.clear();
+        return result;
     }
 };
 
-// -------------------------------------------------------------------------------------------
-class BoxGrid : public IRefCounted
+std::ostream& operator<<(std::ostream& out, const LatencyDistribution& latency)
 {
-public:
-    struct Box
-    {
-        Vertex topLeft;
-        Vertex bottomLeft;
-        Vertex bottomRight;
-        Vertex topRight;
+    return out << "n=" << latency.count << " p50=" << latency.p50 << "ms p95=" << latency.p95
+        << "ms p99=" << latency.p99 << "ms max=" << latency.max << "ms";
+}
 
-        bool hit(Vec2 position, Vec2 size, float collisionBias) const
-        {
-            if (position.x - collisionBias < topRight.position.x
-                && position.x + collisionBias > topLeft.position.x
-                && position.y - collisionBias < topLeft.position.y
-                && position.y + collisionBias > bottomRight.position.y)
-            {
-                return true;
-            }
-            return false;
-        }
-    };
+// -------------------------------------------------------------------------------------------
+using SoundId = uint32_t;
 
+struct SoundStats
+{
+    size_t requested{ 0 };
+    size_t played{ 0 };
+    size_t batches{ 0 };
+};
+
+// Collects play requests during a tick. On flush every requested clip plays once on its own
+// voice, louder when several requests were merged, and not again until its minimum re-trigger
+// interval has passed, so AL work per frame is bounded by the number of clips.
+class SoundQueue : public IRefCounted
+{
 private:
-    Ref<VertexArray> vao;
-    Ref<Buffer>  vbo;
-    Ref<Buffer> ibo;
+    static constexpr float maxGainScale = 2.0f;
 
-    Ref<Shader> shader;
-    std::vector<Box> vertices;
+    struct Voice
+    {
+        Ref<AudioEntry> clip;
+        Ref<AudioSource> source;
+        float gain;
+        double minInterval;
+        double lastPlayed;
+        uint32_t pending;
+    };
 
-    Vec2 position;
-    Vec2 boxSize;
-    float margin;
-    int countX;
-    int countY;
+    // One entry per waveform and pitch, kept across frames for the re-trigger interval
+    struct PendingTone
+    {
+        SynthPatch patch;
+        uint32_t count;
+        double lastPlayed;
+    };
 
-    std::vector<size_t> skippedBoxes;
+    // The interval clips get by default
+    static constexpr double toneMinInterval = 0.05;
 
-    size_t indexCount = 0;
+    std::vector<Voice> voices;
+    std::vector<ALuint> starts;
+    Ref<Synthesizer> synthesizer;
+    std::vector<PendingTone> tones;
+    AudioLatencyProbe latency;
+    SoundStats stats;
 
 public:
-    BoxGrid(Vec2 position, Vec2 boxSize = Vec2(0.5f, 0.5f), float margin = 0.01f, int countX = 10, int countY = 3)
-        :   position(position), boxSize(boxSize), margin(margin), countX(countX), countY(countY)
+    SoundId add(const Ref<AudioEntry>& clip, double minInterval = 0.05, float gain = 1.0f)
     {
-        regenerate();
+        voices.push_back(Voice{ clip, Ref<AudioSource>::make(), gain, minInterval, -INFINITY, 0 });
+        return static_cast<SoundId>(voices.size() - 1);
     }
 
-    void regenerate()
+    void request(SoundId id)
     {
-        vertices = generateVertices(position, boxSize, margin, countX, countY);
-        auto indices = generateIndices(vertices.size());
-
-        vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_STATIC_DRAW, vertices);
-        ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
-
-        vao = Ref<VertexArray>::make();
-
-        std::vector<VertexArray::LayoutElem> layout = {
-            {0, 2, GL_FLOAT, false, sizeof(Vertex), 0}
-        };
-
-        vao->bindVertexBuffer(vbo.get());
-        vao->bindIndexBuffer(ibo.get());
-        vao->bindLayout(layout);
-
-        shader = Ref<Shader>::make("shaders/box.vert", "shaders/box.frag");
+        voices[id].pending++;
+        stats.requested++;
+    }
 
-        indexCount = indices.size();
+    void setSynthesizer(const Ref<Synthesizer>& synth)
+    {
+        synthesizer = synth;
+        tones.reserve(VoiceBank::maxVoices);
     }
 
-    std::vector<Box> generateVertices(Vec2 position, Vec2 boxSize, float margin, int countX, int countY)
+    bool hasSynthesizer() const
     {
-        float lastX = position.x;
-        float lastY = position.y;
+        return synthesizer.get() != nullptr;
+    }
 
-        std::vector<Box> vertices;
-        vertices.reserve(static_cast<size_t>(countX) * countY);
+    // Tones of the same waveform and pitch within a tick merge into one voice, like clips do.
+    // Once the table is full a new pitch takes over the entry that has been idle the longest.
+    // Without a synthesizer (--sampled-hits) tones are dropped.
+    void requestTone(const SynthPatch& patch)
+    {
+        if (!synthesizer.get())
+        {
+            return;
+        }
 
-        size_t boxIndex = 0;
-        for (int y = 0; y < countY; y++)
+        stats.requested++;
+        PendingTone* idle = nullptr;
+        for (auto& tone : tones)
         {
-            for (int x = 0; x < countX; x++)
+            if (tone.patch.waveform == patch.waveform && tone.patch.frequency == patch.frequency)
             {
-                for (auto idx : skippedBoxes)
+                if (tone.count++ == 0)
                 {
-                    if (boxIndex == idx)
-                    {
-                        vertices.emplace_back(Box{ Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f} });
-                        goto skip_box;
-                    }
+                    tone.patch = patch;
                 }
-
-                vertices.emplace_back(Box{
-                   .topLeft = Vec2{ lastX - boxSize.x / 2, lastY + boxSize.y / 2 },
-                   .bottomLeft = Vec2{ lastX - boxSize.x / 2, lastY - boxSize.y / 2 },
-                   .bottomRight = Vec2{ lastX + boxSize.x / 2, lastY - boxSize.y / 2 },
-                   .topRight = Vec2{ lastX + boxSize.x / 2, lastY + boxSize.y / 2 } });
-                
-                skip_box:
-                lastX += margin + boxSize.x;
-                boxIndex++;
+                return;
+            }
+            if (tone.count == 0 && (!idle || tone.lastPlayed < idle->lastPlayed))
+            {
+                idle = &tone;
             }
-            lastY -= margin + boxSize.y;
-            lastX = position.x;
         }
 
-        return vertices;
+        if (tones.size() < VoiceBank::maxVoices)
+        {
+            tones.push_back(PendingTone{ patch, 1, -INFINITY });
+        }
+        else if (idle)
+        {
+            *idle = PendingTone{ patch, 1, -INFINITY };
+        }
     }
 
-    std::vector<GLuint> generateIndices(size_t vertexCount)
+    // Once per frame. All changes land in one AudioBatch and every started voice goes into a
+    // single alSourcePlayv, so the mixer sees the frame's audio as one atomic update.
+    void flush(double now)
     {
-        std::vector<GLuint> indices;
-        indices.reserve(vertexCount * 6);
+        if (synthesizer.get())
+        {
+            bool triggered = false;
+            for (auto& tone : tones)
+            {
+                if (tone.count == 0)
+                {
+                    continue;
+                }
 
-        GLuint lastIdx = 0;
-        for (size_t i = 0; i < vertexCount; i++)
+                if (now - tone.lastPlayed >= toneMinInterval)
+                {
+                    SynthPatch patch = tone.patch;
+                    patch.gain *= std::min(std::sqrt(static_cast<float>(tone.count)), maxGainScale);
+                    stats.played += synthesizer->trigger(patch);
+                    tone.lastPlayed = now;
+                    triggered = true;
+                }
+                tone.count = 0;
+            }
+
+            if (triggered)
+            {
+                latency.measure(synthesizer->getSource(), synthesizer->getPendingSeconds());
+            }
+            synthesizer->update();
+        }
+
+        std::optional<AudioBatch> batch;
+        for (auto& voice : voices)
         {
-            indices.emplace_back(lastIdx);
-            indices.emplace_back(lastIdx + 1);
-            indices.emplace_back(lastIdx + 3);
-            indices.emplace_back(lastIdx + 3);
-            indices.emplace_back(lastIdx + 1);
-            indices.emplace_back(lastIdx + 2);
-            lastIdx += 4;
+            if (voice.pending == 0)
+            {
+                continue;
+            }
+
+            if (now - voice.lastPlayed >= voice.minInterval)
+            {
+                if (!batch)
+                {
+                    batch.emplace();
+                }
+
+                // Simultaneous hits don't line up in phase, loudness grows roughly with the root
+                float scale = std::min(std::sqrt(static_cast<float>(voice.pending)), maxGainScale);
+                voice.source->prepare(voice.clip, voice.gain * scale);
+                starts.push_back(voice.source->getSource());
+                voice.lastPlayed = now;
+                stats.played++;
+            }
+            voice.pending = 0;
         }
 
-        return indices;
+        if (batch)
+        {
+            alSourcePlayv(static_cast<ALsizei>(starts.size()), starts.data());
+            batch.reset();
+            latency.measure(starts.front());
+            starts.clear();
+            stats.batches++;
+        }
     }
 
-    void draw(const Mat4& projection)
+    // Flush to output, the wait from request to flush is under a frame and not included
+    AudioLatencyProbe& getLatency()
     {
-        glBindVertexArray(vao->getId());
-        glUseProgram(shader->getId());
-        shader->setProjectionMatrix(projection);
-        shader->setModelMatrix(glm::identity<glm::mat4>());
-        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT, nullptr);
+        return latency;
     }
 
-    const std::vector<Box>& getBoxes() const
+    // Totals since the last call
+    SoundStats takeStats()
     {
-        return vertices;
+        return std::exchange(stats, SoundStats{});
     }
+};
+#pragma endregion AUDIO SYSTEM
 
-    void destroyBox(size_t idx)
-    {
-        skippedBoxes.push_back(idx);
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- GRAPHICS PRIMITIVES -----------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region GRAPHICS PRIMITIVES
+std::string readTextFile(std::string_view file)
+{
+    std::ifstream f(file.data(), std::ios::ate | std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to open file: "s + std::string(file));
+    }
+    size_t size = f.tellg();
+    f.seekg(0);
+    std::string text(size, '\0');
+    f.read(text.data(), size);
+    return text;
+}
+
+// -------------------------------------------------------------------------------------------
+// FNV-1a, used to key the shader caches
+constexpr uint64_t hashString(std::string_view text, uint64_t hash = 14695981039346656037ull)
+{
+    for (char c : text)
+    {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static_assert(findEmbeddedShader("shaders/common.glsl"), "res/shaders was not embedded");
+
+// Each entry is "NAME" or "NAME=VALUE"
+using ShaderDefines = std::vector<std::string>;
+
+// -------------------------------------------------------------------------------------------
+// Expands #include "file" (relative to the including file, every file included at most once)
+// and injects #defines after the #version line. #line directives number the files, index 0
+// is the stage's own file, so remapLog() can turn driver messages back into file names.
+class ShaderPreprocessor
+{
+public:
+    struct Expanded
+    {
+        std::string text;
+        std::vector<std::string> files;
+    };
+
+private:
+    static constexpr int maxIncludeDepth = 16;
+
+    std::mutex cacheMutex;
+    std::unordered_map<uint64_t, Expanded> cache;
+
+    // Development override, read res/shaders from disk so edits can be hot reloaded
+    std::atomic<bool> readFromDisk = false;
+
+public:
+    static ShaderPreprocessor& get()
+    {
+        static ShaderPreprocessor preprocessor;
+        return preprocessor;
+    }
+
+    // Thread safe, the asset workers expand sources in parallel
+    Expanded expand(std::string_view file, const ShaderDefines& defines)
+    {
+        uint64_t key = hashString(file);
+        for (const auto& define : defines)
+        {
+            key = hashString(define, hashString("\n", key));
+        }
+
+        {
+            std::lock_guard lock(cacheMutex);
+            if (auto it = cache.find(key); it != cache.end())
+            {
+                return it->second;
+            }
+        }
+
+        Expanded expanded;
+        expanded.files.emplace_back(file);
+        std::string text = readFile(file);
+
+        // #version has to stay the first statement, defines go right after it
+        size_t bodyStart = 0;
+        if (text.compare(0, 8, "#version") == 0)
+        {
+            bodyStart = text.find('\n');
+            bodyStart = bodyStart == std::string::npos ? text.size() : bodyStart + 1;
+            expanded.text.append(text, 0, bodyStart);
+        }
+        for (const auto& define : defines)
+        {
+            std::string line = "#define " + define + "\n";
+            std::replace(line.begin(), line.end(), '=', ' ');
+            expanded.text += line;
+        }
+        int firstLine = bodyStart ? 2 : 1;
+        expanded.text += "#line " + std::to_string(firstLine) + " 0\n";
+        appendSource(expanded, std::string_view(text).substr(bodyStart), 0, firstLine, 0);
+
+        std::lock_guard lock(cacheMutex);
+        return cache.try_emplace(key, std::move(expanded)).first->second;
+    }
+
+    void setReadFromDisk(bool value)
+    {
+        readFromDisk = value;
+    }
+
+    bool isReadingFromDisk() const
+    {
+        return readFromDisk;
+    }
+
+    // Embedded copy unless reading from disk, files that weren't embedded fall back to disk
+    std::string readFile(std::string_view file) const
+    {
+        if (!readFromDisk)
+        {
+            if (const EmbeddedShader* shader = findEmbeddedShader(file))
+            {
+                return std::string(shader->source);
+            }
+        }
+        return readTextFile(file);
+    }
+
+    // Drops expanded sources so edited files are read again
+    void clear()
+    {
+        std::lock_guard lock(cacheMutex);
+        cache.clear();
+    }
+
+    // Rewrites "0(12)" and "0:12" style locations at the start of each log line to file names
+    static std::string remapLog(std::string_view log, const std::vector<std::string>& files)
+    {
+        std::string result;
+        while (!log.empty())
+        {
+            size_t end = log.find('\n');
+            std::string_view line = log.substr(0, end);
+            log = end == std::string_view::npos ? std::string_view{} : log.substr(end + 1);
+
+            size_t start = 0;
+            for (std::string_view prefix : { "ERROR: ", "WARNING: " })
+            {
+                if (line.substr(0, prefix.size()) == prefix)
+                {
+                    start = prefix.size();
+                }
+            }
+
+            size_t digits = start;
+            while (digits < line.size() && std::isdigit(static_cast<unsigned char>(line[digits])))
+            {
+                digits++;
+            }
+
+            size_t fileIndex = files.size();
+            if (digits > start && digits < line.size() && (line[digits] == '(' || line[digits] == ':'))
+            {
+                fileIndex = std::strtoul(std::string(line.substr(start, digits - start)).c_str(), nullptr, 10);
+            }
+
+            if (fileIndex < files.size())
+            {
+                result.append(line.substr(0, start)).append(files[fileIndex]).append(line.substr(digits));
+            }
+            else
+            {
+                result.append(line);
+            }
+            result += '\n';
+        }
+        return result;
+    }
+
+private:
+    void appendSource(Expanded& expanded, std::string_view text, size_t fileIndex, int firstLine, int depth)
+    {
+        if (depth > maxIncludeDepth)
+        {
+            throw std::runtime_error("Shader includes nested too deep in "s + expanded.files[fileIndex]);
+        }
+
+        const std::string& file = expanded.files[fileIndex];
+        std::string directory = file.substr(0, file.find_last_of("/\\") + 1);
+
+        int lineNumber = firstLine;
+        while (!text.empty())
+        {
+            size_t end = text.find('\n');
+            std::string_view line = text.substr(0, end);
+            text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+
+            std::string_view trimmed = line.substr(std::min(line.find_first_not_of(" \t"), line.size()));
+            if (trimmed.substr(0, 8) != "#include")
+            {
+                expanded.text.append(line) += '\n';
+                lineNumber++;
+                continue;
+            }
+
+            size_t open = trimmed.find('"');
+            size_t close = trimmed.find('"', open + 1);
+            if (open == std::string_view::npos || close == std::string_view::npos)
+            {
+                throw std::runtime_error("Malformed #include in "s + file + ":" + std::to_string(lineNumber));
+            }
+
+            std::string includePath = directory + std::string(trimmed.substr(open + 1, close - open - 1));
+            lineNumber++;
+            if (std::find(expanded.files.begin(), expanded.files.end(), includePath) != expanded.files.end())
+            {
+                expanded.text += '\n';
+                continue;
+            }
+
+            size_t includeIndex = expanded.files.size();
+            expanded.files.push_back(includePath);
+            std::string includeText = readFile(includePath);
+
+            expanded.text += "#line 1 " + std::to_string(includeIndex) + "\n";
+            appendSource(expanded, includeText, includeIndex, 1, depth + 1);
+            expanded.text += "#line " + std::to_string(lineNumber) + " " + std::to_string(fileIndex) + "\n";
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+struct ShaderSource
+{
+    std::string vertex;
+    std::string fragment;
+
+    // Files the #line indices of each stage refer to
+    std::vector<std::string> vertexFiles;
+    std::vector<std::string> fragmentFiles;
+
+    // Identifies the expanded sources, equal sources share one compiled program
+    uint64_t hash = 0;
+
+    static ShaderSource fromFiles(std::string_view vertFile, std::string_view fragFile, const ShaderDefines& defines = {})
+    {
+        auto& preprocessor = ShaderPreprocessor::get();
+        auto vertex = preprocessor.expand(vertFile, defines);
+        auto fragment = preprocessor.expand(fragFile, defines);
+
+        ShaderSource source{ std::move(vertex.text), std::move(fragment.text), std::move(vertex.files), std::move(fragment.files) };
+        source.hash = hashString(source.fragment, hashString(source.vertex));
+        return source;
+    }
+
+    // "shaders/box" names shaders/box.vert and shaders/box.frag, defines follow a colon:
+    // "shaders/basic:INSTANCED,COUNT=4"
+    static ShaderSource load(std::string_view name)
+    {
+        size_t separator = name.find(':', std::min(name.find_last_of("/\\") + 1, name.size()));
+        std::string base(name.substr(0, separator));
+
+        ShaderDefines defines;
+        while (separator != std::string_view::npos)
+        {
+            size_t next = name.find(',', separator + 1);
+            defines.emplace_back(name.substr(separator + 1, next - separator - 1));
+            separator = next;
+        }
+        return fromFiles(base + ".vert", base + ".frag", defines);
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// GL_KHR_parallel_shader_compile is not part of the generated loader, so it is fetched by hand.
+// Without it the driver compiles on glLinkProgram's first status query and polling always
+// reports completion.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+class ParallelShaderCompile
+{
+private:
+    using PFNGLMAXSHADERCOMPILERTHREADSKHRPROC = void (APIENTRYP)(GLuint count);
+
+    inline static bool enabled = false;
+
+public:
+    // Needs a current context, returns whether compiles will run in the background
+    static bool init(bool allow)
+    {
+        enabled = false;
+        if (!allow)
+        {
+            return false;
+        }
+
+        const char* extensions[] = { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" };
+        const char* procs[] = { "glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB" };
+        for (size_t i = 0; i < std::size(extensions); i++)
+        {
+            if (!glfwExtensionSupported(extensions[i]))
+            {
+                continue;
+            }
+
+            auto maxThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress(procs[i]));
+            if (maxThreads)
+            {
+                // 0xFFFFFFFF lets the driver pick
+                maxThreads(0xFFFFFFFFu);
+                enabled = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool isEnabled()
+    {
+        return enabled;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Optional features, detected once the context is current
+struct GlCapabilities
+{
+    bool parallelShaderCompile = false;
+    bool programBinary = false;
+    bool timerQuery = false;
+};
+
+// Resolves only the entry points in GlFunctions.h, which cmake/ScanGlFunctions.cmake builds
+// from the gl* calls in this file, instead of everything glad knows about
+class GlLoader
+{
+private:
+    inline static GlCapabilities capabilities;
+
+public:
+    // Needs a current context, returns the number of functions resolved
+    static size_t loadUsed()
+    {
+        size_t count = 0;
+#define LOAD_GL_FUNCTION(name, type)                                                \
+        glad_##name = reinterpret_cast<type>(glfwGetProcAddress(#name));           \
+        if (!glad_##name)                                                           \
+        {                                                                           \
+            throw std::runtime_error("Missing GL function " #name);                 \
+        }                                                                           \
+        count++;
+
+        GL_USED_FUNCTIONS(LOAD_GL_FUNCTION)
+#undef LOAD_GL_FUNCTION
+        return count;
+    }
+
+    static const GlCapabilities& detectCapabilities(bool allowParallelCompile)
+    {
+        capabilities.parallelShaderCompile = ParallelShaderCompile::init(allowParallelCompile);
+
+        GLint binaryFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+        capabilities.programBinary = binaryFormats > 0;
+
+        // Core since 3.3, the extension covers older contexts
+        GLint major = 0;
+        GLint minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        capabilities.timerQuery = major * 10 + minor >= 33 || glfwExtensionSupported("GL_ARB_timer_query");
+
+        return capabilities;
+    }
+
+    static const GlCapabilities& getCapabilities()
+    {
+        return capabilities;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+struct UniformStats
+{
+    size_t issued{ 0 };
+    size_t skipped{ 0 };
+};
+
+class Shader : public IRefCounted
+{
+private:
+    GLuint id{ 0 };
+
+    // Kept attached until the link result has been read, their logs explain a failed link
+    GLuint vs{ 0 };
+    GLuint fs{ 0 };
+    bool linked = false;
+
+    // Names for the #line file indices in compile logs, dropped once linked
+    std::vector<std::string> vertexFiles;
+    std::vector<std::string> fragmentFiles;
+
+    inline static size_t liveCount = 0;
+
+    // Reflected once linked. Each uniform owns a slice of the shadow copy, which starts zeroed
+    // just like the program's own uniform storage.
+    struct Uniform
+    {
+        uint64_t nameHash;
+        GLint location;
+        GLenum type;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::vector<Uniform> uniforms;
+    std::vector<std::byte> shadow;
+
+    inline static UniformStats uniformStats;
+
+public:
+    Shader(std::string_view vertFile, std::string_view fragFile)
+        :   Shader(ShaderSource::fromFiles(vertFile, fragFile))
+    {}
+
+    // A deferred shader only submits the compile, poll isCompiled() and then call finish()
+    Shader(const ShaderSource& source, bool deferred = false)
+        :   vertexFiles(source.vertexFiles), fragmentFiles(source.fragmentFiles)
+    {
+        id = glCreateProgram();
+        liveCount++;
+        vs = compileShader(GL_VERTEX_SHADER, source.vertex);
+        fs = compileShader(GL_FRAGMENT_SHADER, source.fragment);
+
+        glAttachShader(id, vs);
+        glAttachShader(id, fs);
+
+        glLinkProgram(id);
+
+        if (!deferred)
+        {
+            finish();
+        }
+    }
+
+    // Never blocks, always true when the driver doesn't compile in the background
+    bool isCompiled() const
+    {
+        if (linked || !ParallelShaderCompile::isEnabled())
+        {
+            return true;
+        }
+
+        GLint done = GL_FALSE;
+        glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    // Reads the link result, blocks if the compile is still running
+    void finish()
+    {
+        if (linked)
+        {
+            return;
+        }
+
+        GLint result = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &result);
+        if (!result)
+        {
+            std::string log = ShaderPreprocessor::remapLog(getShaderLog(vs), vertexFiles)
+                + ShaderPreprocessor::remapLog(getShaderLog(fs), fragmentFiles) + getProgramLog();
+            releaseStages();
+            throw std::runtime_error("Failed to link shader program: "s + log);
+        }
+
+        glValidateProgram(id);
+        releaseStages();
+
+        reflectUniforms();
+        linked = true;
+
+        vertexFiles = {};
+        fragmentFiles = {};
+    }
+
+    ~Shader()
+    {
+        if (id)
+        {
+            if (vs)
+            {
+                releaseStages();
+            }
+            glDeleteProgram(id);
+            liveCount--;
+        }
+    }
+
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    Shader(Shader&& other) noexcept
+        : id(std::exchange(other.id, 0)),
+        vs(std::exchange(other.vs, 0)),
+        fs(std::exchange(other.fs, 0)),
+        linked(std::exchange(other.linked, false)),
+        vertexFiles(std::move(other.vertexFiles)),
+        fragmentFiles(std::move(other.fragmentFiles)),
+        uniforms(std::move(other.uniforms)),
+        shadow(std::move(other.shadow))
+    {}
+
+    Shader& operator=(Shader&& other) noexcept
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (id)
+        {
+            if (vs)
+            {
+                releaseStages();
+            }
+            glDeleteProgram(id);
+            liveCount--;
+        }
+
+        id = std::exchange(other.id, 0);
+        vs = std::exchange(other.vs, 0);
+        fs = std::exchange(other.fs, 0);
+        linked = std::exchange(other.linked, false);
+        vertexFiles = std::move(other.vertexFiles);
+        fragmentFiles = std::move(other.fragmentFiles);
+        uniforms = std::move(other.uniforms);
+        shadow = std::move(other.shadow);
+        return *this;
+    }
+
+    // Compile status is not queried here, that would force the compile to finish
+    GLuint compileShader(GLenum type, const std::string& src)
+    {
+        GLuint shaderId = glCreateShader(type);
+        const char* srcCstr = src.c_str();
+        glShaderSource(shaderId, 1, &srcCstr, nullptr);
+        glCompileShader(shaderId);
+        return shaderId;
+    }
+
+    GLuint getId() const
+    {
+        return id;
+    }
+
+    static size_t getLiveCount()
+    {
+        return liveCount;
+    }
+
+    void setProjectionMatrix(const Mat4& mat)
+    {
+        setUniform("projectionMatrix", mat);
+    }
+
+    void setModelMatrix(const Mat4& mat)
+    {
+        setUniform("modelMatrix", mat);
+    }
+
+    // Setters skip the GL call when the value matches the shadow copy, names the program
+    // doesn't use are ignored like location -1 would be
+    void setUniform(std::string_view name, float value)
+    {
+        if (Uniform* uniform = acquireUpload(name, GL_FLOAT, &value))
+        {
+            glProgramUniform1f(id, uniform->location, value);
+        }
+    }
+
+    void setUniform(std::string_view name, int value)
+    {
+        if (Uniform* uniform = acquireUpload(name, GL_INT, &value))
+        {
+            glProgramUniform1i(id, uniform->location, value);
+        }
+    }
+
+    void setUniform(std::string_view name, const Vec2& value)
+    {
+        if (Uniform* uniform = acquireUpload(name, GL_FLOAT_VEC2, &value))
+        {
+            glProgramUniform2fv(id, uniform->location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void setUniform(std::string_view name, const glm::vec4& value)
+    {
+        if (Uniform* uniform = acquireUpload(name, GL_FLOAT_VEC4, &value))
+        {
+            glProgramUniform4fv(id, uniform->location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void setUniform(std::string_view name, const Mat4& value)
+    {
+        if (Uniform* uniform = acquireUpload(name, GL_FLOAT_MAT4, &value))
+        {
+            glProgramUniformMatrix4fv(id, uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    bool hasUniform(std::string_view name) const
+    {
+        uint64_t nameHash = hashString(name);
+        return std::any_of(uniforms.begin(), uniforms.end(), [nameHash](const Uniform& uniform) { return uniform.nameHash == nameHash; });
+    }
+
+    // Totals across all programs since the last call, read once per frame
+    static UniformStats takeUniformStats()
+    {
+        return std::exchange(uniformStats, UniformStats{});
+    }
+
+private:
+    static uint32_t getUniformSize(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT:
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_BOOL:
+            return 4;
+        case GL_FLOAT_VEC2:
+            return 8;
+        case GL_FLOAT_VEC3:
+            return 12;
+        case GL_FLOAT_VEC4:
+            return 16;
+        case GL_FLOAT_MAT4:
+            return 64;
+        default:
+            // Samplers, images and the rest have no setter and are not shadowed
+            return 0;
+        }
+    }
+
+    void reflectUniforms()
+    {
+        GLint count = 0;
+        GLint maxNameLength = 0;
+        glGetProgramInterfaceiv(id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(id, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+
+        std::string name(static_cast<size_t>(maxNameLength), '\0');
+        const GLenum properties[] = { GL_BLOCK_INDEX, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE };
+
+        uniforms.clear();
+        uint32_t shadowSize = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint values[std::size(properties)] = {};
+            glGetProgramResourceiv(id, GL_UNIFORM, i, static_cast<GLsizei>(std::size(properties)), properties,
+                static_cast<GLsizei>(std::size(values)), nullptr, values);
+
+            // Block members and built-ins have no location of their own
+            if (values[0] != -1 || values[2] < 0)
+            {
+                continue;
+            }
+
+            GLsizei length = 0;
+            glGetProgramResourceName(id, GL_UNIFORM, i, maxNameLength, &length, name.data());
+            std::string_view uniformName(name.data(), length);
+
+            // Arrays are reported as "name[0]", the setters only address the first element
+            if (uniformName.ends_with("[0]"))
+            {
+                uniformName.remove_suffix(3);
+            }
+
+            uint32_t size = getUniformSize(values[1]);
+            uniforms.push_back(Uniform{ hashString(uniformName), values[2], static_cast<GLenum>(values[1]), shadowSize, size });
+            shadowSize += size;
+        }
+        shadow.assign(shadowSize, std::byte{ 0 });
+    }
+
+    // Returns the uniform when the value has to be uploaded, the shadow is already updated
+    Uniform* acquireUpload(std::string_view name, GLenum type, const void* value)
+    {
+        uint64_t nameHash = hashString(name);
+        auto it = std::find_if(uniforms.begin(), uniforms.end(), [nameHash](const Uniform& uniform) { return uniform.nameHash == nameHash; });
+        if (it == uniforms.end())
+        {
+            return nullptr;
+        }
+
+        if (it->type != type)
+        {
+            throw std::runtime_error("Uniform type mismatch: "s + std::string(name));
+        }
+
+        std::byte* slot = shadow.data() + it->offset;
+        if (std::memcmp(slot, value, it->size) == 0)
+        {
+            uniformStats.skipped++;
+            return nullptr;
+        }
+
+        std::memcpy(slot, value, it->size);
+        uniformStats.issued++;
+        return &*it;
+    }
+
+    static std::string getShaderLog(GLuint shaderId)
+    {
+        int result = 0;
+        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &result);
+        if (result)
+        {
+            return {};
+        }
+
+        int shaderLogLength = 0;
+        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &shaderLogLength);
+        std::string log;
+        log.resize(shaderLogLength);
+        glGetShaderInfoLog(shaderId, shaderLogLength, &shaderLogLength, log.data());
+        return log;
+    }
+
+    std::string getProgramLog() const
+    {
+        int programLogLength = 0;
+        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &programLogLength);
+        std::string log;
+        log.resize(programLogLength);
+        glGetProgramInfoLog(id, programLogLength, &programLogLength, log.data());
+        return log;
+    }
+
+    void releaseStages()
+    {
+        glDetachShader(id, fs);
+        glDetachShader(id, vs);
+
+        glDeleteShader(fs);
+        glDeleteShader(vs);
+        fs = vs = 0;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Compiled programs keyed by ShaderSource::hash, so every permutation is compiled once and
+// shared by everything that asks for it. Main thread only.
+class ShaderCache
+{
+private:
+    std::unordered_map<uint64_t, Ref<Shader>> programs;
+
+public:
+    static ShaderCache& get()
+    {
+        static ShaderCache cache;
+        return cache;
+    }
+
+    Ref<Shader> acquire(const ShaderSource& source, bool deferred = false)
+    {
+        auto it = programs.find(source.hash);
+        if (it == programs.end())
+        {
+            it = programs.emplace(source.hash, Ref<Shader>::make(source, deferred)).first;
+        }
+        else if (!deferred)
+        {
+            it->second->finish();
+        }
+        return it->second;
+    }
+
+    // Programs still referenced elsewhere stay alive until released
+    void clear()
+    {
+        programs.clear();
+    }
+
+    size_t getProgramCount() const
+    {
+        return programs.size();
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+struct Vertex
+{
+    Vertex(Vec2 position)
+        : position(position)
+    {}
+
+    Vec2 position;
+};
+
+void APIENTRY glCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+    std::cout << "OpenGL debug message: " << message << std::endl;
+}
+
+// -------------------------------------------------------------------------------------------
+class Buffer : public IRefCounted
+{
+private:
+    GLuint id{ 0 };
+    GLenum kind{ 0 };
+    GLenum usage{ 0 };
+
+    size_t capacity{ 0 };
+    size_t size{ 0 };
+
+    // Buffers are also created on the upload thread
+    inline static std::atomic<size_t> liveCount = 0;
+
+public:
+    template<typename T>
+    Buffer(GLenum kind, GLenum usage, const std::vector<T>& data)
+        : kind(kind), usage(usage)
+    {
+        glCreateBuffers(1, &id);
+        if (id == 0)
+        {
+            throw std::runtime_error("Failed to create buffer");
+        }
+        liveCount++;
+
+        glNamedBufferData(id, data.size() * sizeof T, data.data(), usage);
+    }
+
+    Buffer(GLenum kind, GLenum usage, size_t size)
+        :   capacity(size)
+    {
+        glCreateBuffers(1, &id);
+        if (id == 0)
+        {
+            throw std::runtime_error("Failed to create buffer");
+        }
+        liveCount++;
+
+        glNamedBufferStorage(id, static_cast<GLsizeiptr>(size), nullptr, usage);
+    }
+
+    template<typename T> void batch(const std::vector<T>& data)
+    {
+        assert(size + data.size() * sizeof T < capacity);
+        glNamedBufferSubData(id, size, static_cast<GLsizeiptr>(data.size() * sizeof T), data.data());
+    }
+
+    // Overwrites 'count' elements starting at element 'offset'
+    template<typename T> void update(size_t offset, const T* data, size_t count)
+    {
+        glNamedBufferSubData(id, static_cast<GLintptr>(offset * sizeof(T)), static_cast<GLsizeiptr>(count * sizeof(T)), data);
+    }
+
+    // Needs storage created with GL_MAP_WRITE_BIT
+    void* mapForWrite()
+    {
+        void* data = glMapNamedBufferRange(id, 0, static_cast<GLsizeiptr>(capacity), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!data)
+        {
+            throw std::runtime_error("Failed to map buffer");
+        }
+        return data;
+    }
+
+    void unmap()
+    {
+        glUnmapNamedBuffer(id);
+    }
+
+    ~Buffer()
+    {
+        if (id)
+        {
+            glDeleteBuffers(1, &id);
+            liveCount--;
+        }
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    Buffer(Buffer&& other) noexcept
+        : id(std::exchange(other.id, 0)),
+        kind(other.kind),
+        usage(other.usage),
+        capacity(other.capacity),
+        size(other.size)
+    {}
+
+    Buffer& operator=(Buffer&& other) noexcept
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (id)
+        {
+            glDeleteBuffers(1, &id);
+            liveCount--;
+        }
+        kind = other.kind;
+        usage = other.usage;
+        capacity = other.capacity;
+        size = other.size;
+        id = other.id;
+        other.id = 0;
+        return *this;
+    }
+
+    GLuint getId() const
+    {
+        return id;
+    }
+
+    GLenum getType() const
+    {
+        return kind;
+    }
+
+    static size_t getLiveCount()
+    {
+        return liveCount;
+    }
+};
+
+
+// -------------------------------------------------------------------------------------------
+class VertexArray : public IRefCounted
+{
+private:
+    GLuint id{ 0 };
+
+    inline static size_t liveCount = 0;
+
+public:
+    struct LayoutElem
+    {
+        GLuint index{ 0 };
+        GLenum count{ 0 };
+        GLenum format{ 0 };
+        bool normalized{ false };
+        size_t stride{ 0 };
+        size_t offset{ 0 };
+        GLuint binding{ 0 };
+    };
+
+    VertexArray()
+    {
+        glCreateVertexArrays(1, &id);
+        liveCount++;
+    }
+
+    ~VertexArray()
+    {
+        if (id)
+        {
+            glDeleteVertexArrays(1, &id);
+            liveCount--;
+        }
+    }
+
+    VertexArray(const VertexArray&) = delete;
+    VertexArray& operator=(const VertexArray&) = delete;
+
+    VertexArray(VertexArray&& other) noexcept
+        : id(std::exchange(other.id, 0))
+    {}
+
+    VertexArray& operator=(VertexArray&& other) noexcept
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (id)
+        {
+            glDeleteVertexArrays(1, &id);
+            liveCount--;
+        }
+        id = other.id;
+        other.id = 0;
+        return *this;
+    }
+
+    void bindLayout(const std::vector<LayoutElem> elems)
+    {
+        for (const auto& elem : elems)
+        {
+            glEnableVertexArrayAttrib(id, elem.index);
+
+            glVertexArrayAttribFormat(
+                id,
+                elem.index,
+                elem.count,
+                elem.format,
+                elem.normalized,
+                static_cast<GLuint>(elem.offset)
+            );
+
+            glVertexArrayAttribBinding(id, elem.index, elem.binding);
+        }
+    }
+
+    void bindVertexBuffer(const Buffer* pBuffer)
+    {
+        glVertexArrayVertexBuffer(id, 0, pBuffer->getId(), 0, sizeof Vertex);
+    }
+
+    // Additional binding point, a non-zero divisor advances it per instance instead of per vertex
+    void bindVertexBuffer(const Buffer* pBuffer, GLuint binding, size_t stride, GLuint divisor = 0)
+    {
+        glVertexArrayVertexBuffer(id, binding, pBuffer->getId(), 0, static_cast<GLsizei>(stride));
+        glVertexArrayBindingDivisor(id, binding, divisor);
+    }
+
+    void bindIndexBuffer(const Buffer* pBuffer)
+    {
+        glVertexArrayElementBuffer(id, pBuffer->getId());
+    }
+
+    GLuint getId() const
+    {
+        return id;
+    }
+
+    static size_t getLiveCount()
+    {
+        return liveCount;
+    }
+};
+// -------------------------------------------------------------------------------------------
+class TextureArray : public IRefCounted
+{
+private:
+    GLuint id{ 0 };
+    uint32_t size{ 0 };
+    uint32_t layers{ 0 };
+    uint32_t levels{ 0 };
+
+    // Textures are created on the upload thread
+    inline static std::atomic<size_t> liveCount = 0;
+
+public:
+    // Square RGBA8 layers with immutable storage for every mip level
+    TextureArray(uint32_t size, uint32_t layers, uint32_t levels)
+        :   size(size), layers(layers), levels(levels)
+    {
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &id);
+        if (id == 0)
+        {
+            throw std::runtime_error("Failed to create texture");
+        }
+        liveCount++;
+
+        glTextureStorage3D(id, static_cast<GLsizei>(levels), GL_RGBA8, size, size, layers);
+        glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(id, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels - 1));
+    }
+
+    ~TextureArray()
+    {
+        if (id)
+        {
+            glDeleteTextures(1, &id);
+            liveCount--;
+        }
+    }
+
+    TextureArray(const TextureArray&) = delete;
+    TextureArray& operator=(const TextureArray&) = delete;
+
+    // Level 0 of every layer from the bound GL_PIXEL_UNPACK_BUFFER, mips are generated after
+    void uploadFromPixelBuffer(const Buffer* pixelBuffer)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer->getId());
+        glTextureSubImage3D(id, 0, 0, 0, 0, size, size, layers, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glGenerateTextureMipmap(id);
+    }
+
+    void bind(GLuint unit) const
+    {
+        glBindTextureUnit(unit, id);
+    }
+
+    size_t getMemorySize() const
+    {
+        size_t bytes = 0;
+        for (uint32_t level = 0; level < levels; level++)
+        {
+            size_t side = std::max<size_t>(size >> level, 1);
+            bytes += side * side * 4 * layers;
+        }
+        return bytes;
+    }
+
+    GLuint getId() const
+    {
+        return id;
+    }
+
+    static size_t getLiveCount()
+    {
+        return liveCount;
+    }
+};
+#pragma endregion GRAPHICS PRIMITIVES
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- ASSETS ------------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region ASSETS
+enum class AssetState : uint8_t
+{
+    Decoding,
+    Decoded,
+    Finalizing,
+    Ready,
+    Failed
+};
+
+// Describes how an asset type is loaded: decode() runs on a worker thread and must not touch
+// GL or AL, finalize() runs on the main thread and creates the API objects. An optional
+// poll() keeps the asset finalizing over several frames until it returns true.
+template<typename T>
+struct AssetTraits;
+
+template<>
+struct AssetTraits<Shader>
+{
+    using Decoded = ShaderSource;
+
+    // See ShaderSource::load for the name format
+    static Decoded decode(const std::string& path)
+    {
+        return ShaderSource::load(path);
+    }
+
+    // Programs are only submitted here, the driver compiles them while later frames run
+    static Ref<Shader> finalize(const Decoded& decoded)
+    {
+        return ShaderCache::get().acquire(decoded, true);
+    }
+
+    static bool poll(Ref<Shader>& shader)
+    {
+        if (!shader->isCompiled())
+        {
+            return false;
+        }
+        shader->finish();
+        return true;
+    }
+};
+
+template<>
+struct AssetTraits<AudioEntry>
+{
+    using Decoded = AudioFile;
+
+    static Decoded decode(const std::string& path)
+    {
+        return AudioFile(path);
+    }
+
+    static Ref<AudioEntry> finalize(const Decoded& decoded)
+    {
+        return Ref<AudioEntry>::make(decoded);
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+class IAssetJob : public IRefCounted
+{
+protected:
+    std::atomic<AssetState> state{ AssetState::Decoding };
+    std::string path;
+    std::string error;
+
+public:
+    IAssetJob(std::string path)
+        :   path(std::move(path))
+    {}
+
+    // Worker thread
+    virtual void decode() = 0;
+
+    // Main thread, only called once decode() has finished and again while still finalizing
+    virtual void finalize() = 0;
+
+    AssetState getState() const
+    {
+        return state.load(std::memory_order_acquire);
+    }
+
+    const std::string& getPath() const
+    {
+        return path;
+    }
+
+    const std::string& getError() const
+    {
+        return error;
+    }
+};
+
+template<typename T>
+class AssetSlot : public IAssetJob
+{
+private:
+    std::optional<typename AssetTraits<T>::Decoded> decoded;
+    Ref<T> asset;
+
+public:
+    using IAssetJob::IAssetJob;
+
+    void decode() override
+    {
+        try
+        {
+            decoded.emplace(AssetTraits<T>::decode(path));
+            state.store(AssetState::Decoded, std::memory_order_release);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+            state.store(AssetState::Failed, std::memory_order_release);
+        }
+    }
+
+    void finalize() override
+    {
+        try
+        {
+            if (decoded)
+            {
+                asset = AssetTraits<T>::finalize(*decoded);
+                decoded.reset();
+            }
+
+            if constexpr (requires { AssetTraits<T>::poll(asset); })
+            {
+                if (!AssetTraits<T>::poll(asset))
+                {
+                    state.store(AssetState::Finalizing, std::memory_order_release);
+                    return;
+                }
+            }
+            state.store(AssetState::Ready, std::memory_order_release);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+            decoded.reset();
+            state.store(AssetState::Failed, std::memory_order_release);
+        }
+    }
+
+    const Ref<T>& getAsset() const
+    {
+        return asset;
+    }
+};
+
+// Returned by AssetLoader::load, becomes ready once the loader has finalized the asset
+template<typename T>
+class AssetHandle
+{
+private:
+    Ref<AssetSlot<T>> slot;
+
+public:
+    AssetHandle() = default;
+
+    AssetHandle(Ref<AssetSlot<T>> slot)
+        :   slot(std::move(slot))
+    {}
+
+    bool isReady() const
+    {
+        return slot.get() && slot->getState() == AssetState::Ready;
+    }
+
+    bool isFailed() const
+    {
+        return slot.get() && slot->getState() == AssetState::Failed;
+    }
+
+    Ref<T> get() const
+    {
+        if (!isReady())
+        {
+            throw std::runtime_error("Asset is not loaded: "s + (slot.get() ? slot->getPath() : "<empty>"s));
+        }
+        return slot->getAsset();
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Decodes on a small worker pool and finalizes on the main thread in time-budgeted slices, so
+// the frame loop keeps running while assets stream in
+class AssetLoader
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable queueSignal;
+    std::deque<IAssetJob*> queue;
+    bool stopping = false;
+
+    // Owned by the main thread, workers only ever see raw pointers to jobs in this list
+    std::vector<Ref<IAssetJob>> pending;
+    std::vector<std::string> failures;
+
+    size_t requestedCount = 0;
+    size_t completedCount = 0;
+
+public:
+    AssetLoader(size_t workerCount = defaultWorkerCount())
+    {
+        workers.reserve(workerCount);
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~AssetLoader()
+    {
+        {
+            std::lock_guard lock(queueMutex);
+            stopping = true;
+        }
+        queueSignal.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    template<typename T>
+    AssetHandle<T> load(std::string path)
+    {
+        auto slot = Ref<AssetSlot<T>>::make(std::move(path));
+        pending.push_back(slot);
+        requestedCount++;
+        {
+            std::lock_guard lock(queueMutex);
+            queue.push_back(slot.get());
+        }
+        queueSignal.notify_one();
+        return AssetHandle<T>(std::move(slot));
+    }
+
+    // Finalizes decoded assets until the budget runs out, at least one step per call so loading
+    // always makes progress. Returns the number of assets finished this call.
+    size_t pump(double budgetSeconds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t finished = 0;
+        for (size_t i = 0; i < pending.size();)
+        {
+            IAssetJob* job = pending[i].get();
+            AssetState state = job->getState();
+            if (state == AssetState::Decoding)
+            {
+                i++;
+                continue;
+            }
+
+            if (state == AssetState::Decoded || state == AssetState::Finalizing)
+            {
+                job->finalize();
+                state = job->getState();
+            }
+
+            if (state == AssetState::Finalizing)
+            {
+                i++;
+            }
+            else
+            {
+                if (state == AssetState::Failed)
+                {
+                    std::cerr << "Failed to load " << job->getPath() << ": " << job->getError() << std::endl;
+                    failures.push_back(job->getPath());
+                }
+
+                pending.erase(pending.begin() + i);
+                completedCount++;
+                finished++;
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= budgetSeconds)
+            {
+                break;
+            }
+        }
+        return finished;
+    }
+
+    bool isIdle() const
+    {
+        return pending.empty();
+    }
+
+    float getProgress() const
+    {
+        return requestedCount ? static_cast<float>(completedCount) / requestedCount : 1.0f;
+    }
+
+    const std::vector<std::string>& getFailures() const
+    {
+        return failures;
+    }
+
+private:
+    static size_t defaultWorkerCount()
+    {
+        // Leave a core for the main thread, decoding is file bound past a couple of workers
+        size_t cores = std::thread::hardware_concurrency();
+        return std::clamp<size_t>(cores > 1 ? cores - 1 : 1, 1, 4);
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            IAssetJob* job = nullptr;
+            {
+                std::unique_lock lock(queueMutex);
+                queueSignal.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (stopping)
+                {
+                    return;
+                }
+                job = queue.front();
+                queue.pop_front();
+            }
+            job->decode();
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// GL work for the upload context. run() executes on the upload thread, complete() runs on the
+// main thread once the fence issued after run() has signalled.
+class IUploadJob : public IRefCounted
+{
+public:
+    virtual void run() = 0;
+    virtual void complete() = 0;
+};
+
+// Owns a hidden window whose context shares objects with the main one, so buffers can be
+// created and filled without stalling the frame. VAOs are container objects and are not
+// shared, jobs create those on the main thread in complete().
+class GpuUploader
+{
+private:
+    struct Finished
+    {
+        IUploadJob* job;
+        GLsync fence;
+    };
+
+    GLFWwindow* context{ nullptr };
+    std::thread thread;
+    std::mutex queueMutex;
+    std::condition_variable queueSignal;
+    std::deque<IUploadJob*> queue;
+    std::deque<Finished> finished;
+    bool stopping = false;
+
+    // Owned by the main thread in submission order, the upload thread only sees raw pointers
+    std::deque<Ref<IUploadJob>> pending;
+
+public:
+    // Main thread only, GLFW creates windows there
+    GpuUploader(GLFWwindow* mainWindow)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "", nullptr, mainWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (!context)
+        {
+            throw std::runtime_error("Failed to create the upload context");
+        }
+
+        thread = std::thread([this]() { uploadLoop(); });
+    }
+
+    ~GpuUploader()
+    {
+        {
+            std::lock_guard lock(queueMutex);
+            stopping = true;
+        }
+        queueSignal.notify_all();
+        thread.join();
+
+        for (auto& entry : finished)
+        {
+            glDeleteSync(entry.fence);
+        }
+        glfwDestroyWindow(context);
+    }
+
+    GpuUploader(const GpuUploader&) = delete;
+    GpuUploader& operator=(const GpuUploader&) = delete;
+
+    void submit(Ref<IUploadJob> job)
+    {
+        {
+            std::lock_guard lock(queueMutex);
+            queue.push_back(job.get());
+        }
+        pending.push_back(std::move(job));
+        queueSignal.notify_one();
+    }
+
+    // Completes every job whose fence has signalled, never waits on the GPU
+    size_t pump()
+    {
+        size_t completed = 0;
+        for (;;)
+        {
+            Finished entry;
+            {
+                std::lock_guard lock(queueMutex);
+                if (finished.empty())
+                {
+                    break;
+                }
+                entry = finished.front();
+            }
+
+            GLenum status = glClientWaitSync(entry.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                break;
+            }
+
+            {
+                std::lock_guard lock(queueMutex);
+                finished.pop_front();
+            }
+            glDeleteSync(entry.fence);
+
+            // One upload thread, jobs finish in the order they were submitted
+            pending.front()->complete();
+            pending.pop_front();
+            completed++;
+        }
+        return completed;
+    }
+
+    size_t getPendingCount() const
+    {
+        return pending.size();
+    }
+
+private:
+    void uploadLoop()
+    {
+        glfwMakeContextCurrent(context);
+        for (;;)
+        {
+            IUploadJob* job = nullptr;
+            {
+                std::unique_lock lock(queueMutex);
+                queueSignal.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (stopping)
+                {
+                    break;
+                }
+                job = queue.front();
+                queue.pop_front();
+            }
+
+            try
+            {
+                job->run();
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Upload failed: " << e.what() << std::endl;
+            }
+
+            // The flush gets the fence to the GPU so the main context can see it signal
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            std::lock_guard lock(queueMutex);
+            finished.push_back(Finished{ job, fence });
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Sprites packed from res/sprites at build time (tools/AtlasPacker.cpp). The atlas is uploaded
+// once through a pixel buffer and stays bound to one texture unit, sprites only pick a region.
+class SpriteAtlas
+{
+private:
+    class UploadJob : public IUploadJob
+    {
+    public:
+        SpriteAtlas* atlas;
+        Ref<TextureArray> texture;
+        Ref<Buffer> pixelBuffer;
+
+        UploadJob(SpriteAtlas* atlas)
+            :   atlas(atlas)
+        {}
+
+        void run() override
+        {
+            pixelBuffer = Ref<Buffer>::make(GL_PIXEL_UNPACK_BUFFER, GL_MAP_WRITE_BIT, atlasPixels.size());
+            std::memcpy(pixelBuffer->mapForWrite(), atlasPixels.data(), atlasPixels.size());
+            pixelBuffer->unmap();
+
+            texture = Ref<TextureArray>::make(atlasLayerSize, atlasLayerCount, atlasMipLevels);
+            texture->uploadFromPixelBuffer(pixelBuffer.get());
+        }
+
+        void complete() override
+        {
+            // Past the fence the copy out of the pixel buffer has finished
+            pixelBuffer = {};
+            if (atlas)
+            {
+                atlas->finishUpload(std::move(texture));
+            }
+        }
+    };
+
+    Ref<TextureArray> texture;
+    Ref<UploadJob> pendingUpload;
+    double uploadStart = 0.0;
+
+public:
+    SpriteAtlas() = default;
+
+    ~SpriteAtlas()
+    {
+        if (pendingUpload.get())
+        {
+            pendingUpload->atlas = nullptr;
+        }
+    }
+
+    SpriteAtlas(const SpriteAtlas&) = delete;
+    SpriteAtlas& operator=(const SpriteAtlas&) = delete;
+
+    // Uploads on the upload context when there is one, does nothing once uploaded
+    void upload(GpuUploader* uploader)
+    {
+        if (texture.get() || pendingUpload.get())
+        {
+            return;
+        }
+
+        uploadStart = glfwGetTime();
+        pendingUpload = Ref<UploadJob>::make(this);
+        if (uploader)
+        {
+            uploader->submit(pendingUpload);
+            return;
+        }
+
+        auto job = pendingUpload;
+        job->run();
+        job->complete();
+    }
+
+    bool isReady() const
+    {
+        return texture.get() != nullptr;
+    }
+
+    // Points the shader's spriteRect and spriteLayer uniforms at a region
+    static void apply(Shader& shader, const AtlasRegion& region)
+    {
+        shader.setUniform("spriteRect", glm::vec4(region.u0, region.v0, region.u1, region.v1));
+        shader.setUniform("spriteLayer", static_cast<int>(region.layer));
+    }
+
+    void bind(GLuint unit) const
+    {
+        texture->bind(unit);
+    }
+
+    static const AtlasRegion& getRegion(std::string_view name)
+    {
+        const AtlasRegion* region = findAtlasRegion(name);
+        if (!region)
+        {
+            throw std::runtime_error("No sprite named "s + std::string(name));
+        }
+        return *region;
+    }
+
+private:
+    void finishUpload(Ref<TextureArray> uploaded)
+    {
+        pendingUpload = {};
+        if (!uploaded.get())
+        {
+            throw std::runtime_error("Failed to upload the sprite atlas");
+        }
+        texture = std::move(uploaded);
+
+        std::cout << "Sprite atlas: " << atlasRegions.size() << " sprites in " << atlasLayerCount << " layer(s), "
+            << texture->getMemorySize() / 1024 << " KiB with mips, uploaded in "
+            << (glfwGetTime() - uploadStart) * 1000.0 << " ms" << std::endl;
+    }
+};
+#pragma endregion ASSETS
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- COLLISION ---------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region COLLISION
+struct Aabb
+{
+    Vec2 min{ 0.0f, 0.0f };
+    Vec2 max{ 0.0f, 0.0f };
+
+    static Aabb empty()
+    {
+        return Aabb{ Vec2{ INFINITY, INFINITY }, Vec2{ -INFINITY, -INFINITY } };
+    }
+
+    static Aabb fromCenter(Vec2 center, Vec2 halfSize)
+    {
+        return Aabb{ center - halfSize, center + halfSize };
+    }
+
+    bool isEmpty() const
+    {
+        return min.x > max.x || min.y > max.y;
+    }
+
+    bool overlaps(const Aabb& other) const
+    {
+        return min.x < other.max.x && max.x > other.min.x
+            && min.y < other.max.y && max.y > other.min.y;
+    }
+
+    void expand(const Aabb& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    Vec2 getCenter() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    float getMinExtent() const
+    {
+        return std::min(max.x - min.x, max.y - min.y);
+    }
+
+    bool operator==(const Aabb& other) const
+    {
+        return min == other.min && max == other.max;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Static bounding volume hierarchy over brick bounds. Bricks are sorted along a Morton curve
+// and split top-down at the highest differing code bit, which builds a million bricks in a
+// fraction of a second. Removing a brick does not rebuild the tree, it only shrinks the
+// bounds on the path from its leaf to the root. Edits refit the same way, new bricks split
+// the leaf they fit best into.
+class BrickBvh
+{
+private:
+    static constexpr uint32_t leafSize = 4;
+    static constexpr uint32_t invalidNode = ~0u;
+    static constexpr uint32_t maxDepth = 96;
+
+    struct Node
+    {
+        Aabb bounds;
+        uint32_t parent{ invalidNode };
+        // Leaf: first index into 'order', inner: index of the left child (right is left + 1)
+        uint32_t first{ 0 };
+        uint32_t count{ 0 };
+
+        bool isLeaf() const
+        {
+            return count != 0;
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Aabb> bricks;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> codes;
+    std::vector<uint32_t> leafOf;
+    std::vector<bool> alive;
+    // Nodes below this index still wait for removeBatch()'s sweep
+    size_t refitCursor{ 0 };
+
+public:
+    BrickBvh() = default;
+
+    explicit BrickBvh(const std::vector<Aabb>& layout)
+    {
+        build(layout);
+    }
+
+    void build(const std::vector<Aabb>& layout)
+    {
+        bricks = layout;
+        alive.assign(bricks.size(), true);
+        leafOf.assign(bricks.size(), invalidNode);
+        nodes.clear();
+        refitCursor = 0;
+
+        if (bricks.empty())
+        {
+            return;
+        }
+
+        Aabb sceneBounds = Aabb::empty();
+        for (const auto& brick : bricks)
+        {
+            sceneBounds.expand(brick);
+        }
+
+        // Sort bricks by the Morton code of their centers
+        std::vector<std::pair<uint32_t, uint32_t>> keyed(bricks.size());
+        Vec2 extent = glm::max(sceneBounds.max - sceneBounds.min, Vec2(1e-6f));
+        for (uint32_t i = 0; i < bricks.size(); i++)
+        {
+            Vec2 normalized = (bricks[i].getCenter() - sceneBounds.min) / extent;
+            keyed[i] = { mortonCode(normalized), i };
+        }
+        std::sort(keyed.begin(), keyed.end());
+
+        order.resize(bricks.size());
+        codes.resize(bricks.size());
+        for (size_t i = 0; i < keyed.size(); i++)
+        {
+            codes[i] = keyed[i].first;
+            order[i] = keyed[i].second;
+        }
+
+        nodes.reserve(2 * bricks.size() / leafSize + 1);
+        nodes.emplace_back();
+        buildNode(0, 0, static_cast<uint32_t>(bricks.size()));
+
+        codes.clear();
+        codes.shrink_to_fit();
+    }
+
+    void remove(size_t brick)
+    {
+        if (!alive[brick])
+        {
+            return;
+        }
+        alive[brick] = false;
+        refit(leafOf[brick]);
+    }
+
+    // Large batches leave the bounds to one bottom-up pass over the whole tree instead of walking
+    // up from every leaf. Children always come after their parent in 'nodes', so a reverse sweep
+    // suffices, and refitSome() carries it out a slice at a time. Until it is done the bounds
+    // only cover more than they need to, queries skip the removed bricks either way.
+    void removeBatch(const std::vector<uint32_t>& removed)
+    {
+        for (uint32_t brick : removed)
+        {
+            alive[brick] = false;
+        }
+
+        if (removed.size() * leafSize < nodes.size())
+        {
+            for (uint32_t brick : removed)
+            {
+                refit(leafOf[brick]);
+            }
+            return;
+        }
+        refitCursor = nodes.size();
+    }
+
+    // Continues the sweep removeBatch() started for up to 'nodeBudget' nodes, returns whether
+    // some of it is left
+    bool refitSome(size_t nodeBudget)
+    {
+        size_t end = refitCursor > nodeBudget ? refitCursor - nodeBudget : 0;
+        for (; refitCursor > end; refitCursor--)
+        {
+            Node& node = nodes[refitCursor - 1];
+            if (node.isLeaf())
+            {
+                node.bounds = Aabb::empty();
+                for (uint32_t j = node.first; j < node.first + node.count; j++)
+                {
+                    if (alive[order[j]])
+                    {
+                        node.bounds.expand(bricks[order[j]]);
+                    }
+                }
+            }
+            else
+            {
+                node.bounds = nodes[node.first].bounds;
+                node.bounds.expand(nodes[node.first + 1].bounds);
+            }
+        }
+        return refitCursor > 0;
+    }
+
+    // Moves, resizes or revives an existing brick
+    void update(size_t brick, const Aabb& bounds)
+    {
+        bricks[brick] = bounds;
+        alive[brick] = true;
+        refit(leafOf[brick]);
+    }
+
+    // Adds a brick with index getBrickCount() and returns that index
+    size_t insert(const Aabb& bounds)
+    {
+        uint32_t brick = static_cast<uint32_t>(bricks.size());
+        bricks.push_back(bounds);
+        alive.push_back(true);
+        leafOf.push_back(invalidNode);
+
+        if (nodes.empty())
+        {
+            build(bricks);
+            return brick;
+        }
+
+        // Descend towards the child whose bounds grow the least
+        uint32_t nodeIndex = 0;
+        uint32_t depth = 0;
+        while (!nodes[nodeIndex].isLeaf())
+        {
+            uint32_t left = nodes[nodeIndex].first;
+            nodeIndex = growth(nodes[left].bounds, bounds) <= growth(nodes[left + 1].bounds, bounds) ? left : left + 1;
+            depth++;
+        }
+
+        // Keep the traversal stack bounded when many bricks pile up in one spot
+        if (depth + 1 >= maxDepth)
+        {
+            std::vector<Aabb> layout = bricks;
+            std::vector<bool> aliveMask = alive;
+            build(layout);
+            alive = aliveMask;
+            for (size_t i = 0; i < alive.size(); i++)
+            {
+                if (!alive[i])
+                {
+                    refit(leafOf[i]);
+                }
+            }
+            return brick;
+        }
+
+        // Turn the leaf into an inner node holding its old contents and the new brick
+        uint32_t left = static_cast<uint32_t>(nodes.size());
+        Node oldLeaf = nodes[nodeIndex];
+        oldLeaf.parent = nodeIndex;
+        nodes.push_back(oldLeaf);
+        for (uint32_t i = oldLeaf.first; i < oldLeaf.first + oldLeaf.count; i++)
+        {
+            leafOf[order[i]] = left;
+        }
+
+        Node newLeaf;
+        newLeaf.bounds = bounds;
+        newLeaf.parent = nodeIndex;
+        newLeaf.first = static_cast<uint32_t>(order.size());
+        newLeaf.count = 1;
+        nodes.push_back(newLeaf);
+        order.push_back(brick);
+        leafOf[brick] = left + 1;
+
+        nodes[nodeIndex].first = left;
+        nodes[nodeIndex].count = 0;
+        refit(nodeIndex);
+        return brick;
+    }
+
+    size_t getBrickCount() const
+    {
+        return bricks.size();
+    }
+
+    // Returns the lowest brick index overlapping the box, the same one a linear scan would find
+    bool queryFirst(const Aabb& box, size_t& hitIndex) const
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        std::array<uint32_t, 128> stack;
+        size_t top = 0;
+        stack[top++] = 0;
+
+        bool found = false;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            if (!node.bounds.overlaps(box))
+            {
+                continue;
+            }
+
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                {
+                    uint32_t brick = order[i];
+                    if (alive[brick] && bricks[brick].overlaps(box) && (!found || brick < hitIndex))
+                    {
+                        hitIndex = brick;
+                        found = true;
+                    }
+                }
+            }
+            else
+            {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+        return found;
+    }
+
+    // Sweeps a square of half size 'halfExtent' from 'origin' along the ray and calls
+    // test(brick) for the alive bricks of every leaf it reaches within limit(). 'test' may
+    // lower the limit as it finds hits; the nearer child is searched first to make use of that.
+    template<typename Limit, typename Test>
+    void raycast(Vec2 origin, Vec2 inverseDirection, float halfExtent, const Limit& limit, const Test& test) const
+    {
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        std::array<uint32_t, 128> stack;
+        size_t top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            if (sweepEnter(node.bounds, origin, inverseDirection, halfExtent) > limit())
+            {
+                continue;
+            }
+
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                {
+                    if (alive[order[i]])
+                    {
+                        test(order[i]);
+                    }
+                }
+            }
+            else
+            {
+                float left = sweepEnter(nodes[node.first].bounds, origin, inverseDirection, halfExtent);
+                float right = sweepEnter(nodes[node.first + 1].bounds, origin, inverseDirection, halfExtent);
+                uint32_t nearer = left <= right ? node.first : node.first + 1;
+                stack[top++] = nearer ^ node.first ^ (node.first + 1);
+                stack[top++] = nearer;
+            }
+        }
+    }
+
+    size_t getNodeCount() const
+    {
+        return nodes.size();
+    }
+
+private:
+    // Distance along the ray at which the swept square starts touching 'bounds', zero if it
+    // already does and INFINITY if it never does
+    static float sweepEnter(const Aabb& bounds, Vec2 origin, Vec2 inverseDirection, float halfExtent)
+    {
+        if (bounds.isEmpty())
+        {
+            return INFINITY;
+        }
+
+        float x0 = (bounds.min.x - halfExtent - origin.x) * inverseDirection.x;
+        float x1 = (bounds.max.x + halfExtent - origin.x) * inverseDirection.x;
+        float y0 = (bounds.min.y - halfExtent - origin.y) * inverseDirection.y;
+        float y1 = (bounds.max.y + halfExtent - origin.y) * inverseDirection.y;
+        float enter = std::max({ std::min(x0, x1), std::min(y0, y1), 0.0f });
+        float exit = std::min(std::max(x0, x1), std::max(y0, y1));
+        return enter <= exit ? enter : INFINITY;
+    }
+
+    static float growth(const Aabb& node, const Aabb& bounds)
+    {
+        Aabb merged = node;
+        merged.expand(bounds);
+        Vec2 before = node.isEmpty() ? Vec2(0.0f) : node.max - node.min;
+        Vec2 after = merged.max - merged.min;
+        return after.x * after.y - before.x * before.y;
+    }
+
+    static uint32_t expandBits(uint32_t value)
+    {
+        value &= 0x0000ffff;
+        value = (value | (value << 8)) & 0x00ff00ff;
+        value = (value | (value << 4)) & 0x0f0f0f0f;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    }
+
+    static uint32_t mortonCode(Vec2 normalized)
+    {
+        uint32_t x = static_cast<uint32_t>(glm::clamp(normalized.x, 0.0f, 1.0f) * 65535.0f);
+        uint32_t y = static_cast<uint32_t>(glm::clamp(normalized.y, 0.0f, 1.0f) * 65535.0f);
+        return (expandBits(y) << 1) | expandBits(x);
+    }
+
+    uint32_t findSplit(uint32_t first, uint32_t last) const
+    {
+        uint32_t firstCode = codes[first];
+        uint32_t lastCode = codes[last - 1];
+        if (firstCode == lastCode)
+        {
+            return (first + last) / 2;
+        }
+
+        // First element whose code has the highest differing bit set
+        uint32_t highestBit = 0x80000000u >> std::countl_zero(firstCode ^ lastCode);
+        auto begin = codes.begin() + first;
+        auto split = std::partition_point(begin, codes.begin() + last, [&](uint32_t code) { return (code & highestBit) == 0; });
+        return static_cast<uint32_t>(split - codes.begin());
+    }
+
+    void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t last)
+    {
+        uint32_t count = last - first;
+        if (count <= leafSize)
+        {
+            Node& leaf = nodes[nodeIndex];
+            leaf.first = first;
+            leaf.count = count;
+            leaf.bounds = Aabb::empty();
+            for (uint32_t i = first; i < last; i++)
+            {
+                leaf.bounds.expand(bricks[order[i]]);
+                leafOf[order[i]] = nodeIndex;
+            }
+            return;
+        }
+
+        uint32_t split = findSplit(first, last);
+        uint32_t left = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[left].parent = nodeIndex;
+        nodes[left + 1].parent = nodeIndex;
+        nodes[nodeIndex].first = left;
+
+        buildNode(left, first, split);
+        buildNode(left + 1, split, last);
+
+        Aabb bounds = nodes[left].bounds;
+        bounds.expand(nodes[left + 1].bounds);
+        nodes[nodeIndex].bounds = bounds;
+    }
+
+    void refit(uint32_t nodeIndex)
+    {
+        while (nodeIndex != invalidNode)
+        {
+            Node& node = nodes[nodeIndex];
+            Aabb bounds = Aabb::empty();
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                {
+                    if (alive[order[i]])
+                    {
+                        bounds.expand(bricks[order[i]]);
+                    }
+                }
+            }
+            else
+            {
+                bounds = nodes[node.first].bounds;
+                bounds.expand(nodes[node.first + 1].bounds);
+            }
+
+            // Ancestors only depend on this node's bounds, stop as soon as they stop shrinking
+            if (bounds == node.bounds)
+            {
+                return;
+            }
+            node.bounds = bounds;
+            nodeIndex = node.parent;
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// One bit per grid cell, packed into 64-bit words row by row. The summary level keeps a bit per
+// non-empty word of each row and a bit per non-empty row, so row and lowest-cell queries are a
+// few bit scans and region queries test whole words and skip the empty ones.
+class OccupancyBitmap
+{
+private:
+    int width{ 0 };
+    int height{ 0 };
+    size_t wordsPerRow{ 0 };
+    size_t summaryPerRow{ 0 };
+
+    std::vector<uint64_t> cells;
+    std::vector<uint64_t> summary;
+    std::vector<uint64_t> rows;
+
+    static uint64_t lowMask(size_t end)
+    {
+        return end >= 64 ? ~0ull : (1ull << end) - 1;
+    }
+
+    // Whether any bit in [begin, end) is set
+    static bool anyBits(const uint64_t* words, size_t begin, size_t end)
+    {
+        if (begin >= end)
+        {
+            return false;
+        }
+
+        size_t first = begin / 64;
+        size_t last = (end - 1) / 64;
+        uint64_t firstMask = ~0ull << (begin % 64);
+        uint64_t lastMask = lowMask((end - 1) % 64 + 1);
+        if (first == last)
+        {
+            return (words[first] & firstMask & lastMask) != 0;
+        }
+
+        if ((words[first] & firstMask) || (words[last] & lastMask))
+        {
+            return true;
+        }
+        for (size_t i = first + 1; i < last; i++)
+        {
+            if (words[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static size_t countBits(const uint64_t* words, size_t begin, size_t end)
+    {
+        if (begin >= end)
+        {
+            return 0;
+        }
+
+        size_t first = begin / 64;
+        size_t last = (end - 1) / 64;
+        uint64_t firstMask = ~0ull << (begin % 64);
+        uint64_t lastMask = lowMask((end - 1) % 64 + 1);
+        if (first == last)
+        {
+            return std::popcount(words[first] & firstMask & lastMask);
+        }
+
+        size_t count = std::popcount(words[first] & firstMask) + std::popcount(words[last] & lastMask);
+        for (size_t i = first + 1; i < last; i++)
+        {
+            count += std::popcount(words[i]);
+        }
+        return count;
+    }
+
+    static void assignBit(uint64_t& word, size_t bit, bool value)
+    {
+        word = value ? word | (1ull << bit) : word & ~(1ull << bit);
+    }
+
+    // Clamps [x0, x1) x [y0, y1) to the grid, false if nothing is left
+    bool clampRect(int& x0, int& y0, int& x1, int& y1) const
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, width);
+        y1 = std::min(y1, height);
+        return x0 < x1 && y0 < y1;
+    }
+
+public:
+    OccupancyBitmap() = default;
+
+    OccupancyBitmap(int width, int height)
+    {
+        reset(width, height);
+    }
+
+    // Resizes to width x height cells, all empty
+    void reset(int newWidth, int newHeight)
+    {
+        width = newWidth;
+        height = newHeight;
+        wordsPerRow = (static_cast<size_t>(width) + 63) / 64;
+        summaryPerRow = (wordsPerRow + 63) / 64;
+        cells.assign(wordsPerRow * height, 0);
+        summary.assign(summaryPerRow * height, 0);
+        rows.assign((static_cast<size_t>(height) + 63) / 64, 0);
+    }
+
+    // Widens the rows to at least minWidth cells, keeping their contents. The width at least
+    // doubles, so growing a cell at a time copies each cell a constant number of times.
+    void growWidth(int minWidth)
+    {
+        if (minWidth <= width)
+        {
+            return;
+        }
+
+        OccupancyBitmap grown(std::max(minWidth, width * 2), height);
+        for (int y = 0; y < height; y++)
+        {
+            std::copy_n(cells.data() + y * wordsPerRow, wordsPerRow, grown.cells.data() + y * grown.wordsPerRow);
+            std::copy_n(summary.data() + y * summaryPerRow, summaryPerRow, grown.summary.data() + y * grown.summaryPerRow);
+        }
+        grown.rows = rows;
+        *this = std::move(grown);
+    }
+
+    void set(int x, int y, bool occupied)
+    {
+        size_t wordInRow = static_cast<size_t>(x) / 64;
+        uint64_t& word = cells[y * wordsPerRow + wordInRow];
+        assignBit(word, x % 64, occupied);
+
+        uint64_t* rowSummary = &summary[y * summaryPerRow];
+        assignBit(rowSummary[wordInRow / 64], wordInRow % 64, word != 0);
+
+        assignBit(rows[y / 64], y % 64, anyBits(rowSummary, 0, wordsPerRow));
+    }
+
+    bool test(int x, int y) const
+    {
+        return (cells[y * wordsPerRow + x / 64] >> (x % 64)) & 1;
+    }
+
+    // Cells [x, x + count) of row y as the low bits of the result, count up to 63. Cells outside
+    // the grid read as empty.
+    uint64_t getRowBits(int x, int y, int count) const
+    {
+        if (y < 0 || y >= height || x >= width || x + count <= 0)
+        {
+            return 0;
+        }
+
+        int skipped = 0;
+        if (x < 0)
+        {
+            skipped = -x;
+            count -= skipped;
+            x = 0;
+        }
+
+        const uint64_t* row = &cells[y * wordsPerRow];
+        size_t word = static_cast<size_t>(x) / 64;
+        int shift = x % 64;
+        uint64_t bits = row[word] >> shift;
+        if (shift + count > 64 && word + 1 < wordsPerRow)
+        {
+            bits |= row[word + 1] << (64 - shift);
+        }
+        return (bits & lowMask(count)) << skipped;
+    }
+
+    // Cells [x, x + 3) of rows y, y + 1 and y + 2 as nine bits, three per row. Cells outside
+    // the grid read as empty.
+    uint64_t getBlock3x3(int x, int y) const
+    {
+        if (x >= 0 && y >= 0 && x + 3 <= width && y + 3 <= height && x % 64 <= 61)
+        {
+            const uint64_t* row = &cells[y * wordsPerRow + static_cast<size_t>(x) / 64];
+            int shift = x % 64;
+            return ((row[0] >> shift) & 7)
+                | (((row[wordsPerRow] >> shift) & 7) << 3)
+                | (((row[2 * wordsPerRow] >> shift) & 7) << 6);
+        }
+        return getRowBits(x, y, 3) | (getRowBits(x, y + 1, 3) << 3) | (getRowBits(x, y + 2, 3) << 6);
+    }
+
+    bool anyInRow(int y) const
+    {
+        return y >= 0 && y < height && ((rows[y / 64] >> (y % 64)) & 1);
+    }
+
+    // Whole words of a row, cell x of the row is bit x % 64 of word x / 64
+    uint64_t getWord(int y, size_t word) const
+    {
+        return cells[y * wordsPerRow + word];
+    }
+
+    // Empties the cells of 'mask' in one word with a single summary update
+    void clearWord(int y, size_t word, uint64_t mask)
+    {
+        uint64_t& bits = cells[y * wordsPerRow + word];
+        bits &= ~mask;
+
+        uint64_t* rowSummary = &summary[y * summaryPerRow];
+        assignBit(rowSummary[word / 64], word % 64, bits != 0);
+        assignBit(rows[y / 64], y % 64, anyBits(rowSummary, 0, wordsPerRow));
+    }
+
+    // Highest row index with an occupied cell
+    bool findLastRow(int& y) const
+    {
+        for (size_t i = rows.size(); i-- > 0;)
+        {
+            if (rows[i])
+            {
+                y = static_cast<int>(i * 64 + 63 - std::countl_zero(rows[i]));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findFirstInRow(int y, int& x) const
+    {
+        const uint64_t* rowSummary = &summary[y * summaryPerRow];
+        for (size_t i = 0; i < summaryPerRow; i++)
+        {
+            if (rowSummary[i])
+            {
+                size_t word = i * 64 + std::countr_zero(rowSummary[i]);
+                x = static_cast<int>(word * 64 + std::countr_zero(cells[y * wordsPerRow + word]));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Any occupied cell in [x0, x1) x [y0, y1), clamped to the grid
+    bool anyInRect(int x0, int y0, int x1, int y1) const
+    {
+        if (!clampRect(x0, y0, x1, y1) || !anyBits(rows.data(), y0, y1))
+        {
+            return false;
+        }
+
+        size_t first = static_cast<size_t>(x0) / 64;
+        size_t last = static_cast<size_t>(x1 - 1) / 64;
+        uint64_t firstMask = ~0ull << (x0 % 64);
+        uint64_t lastMask = lowMask((x1 - 1) % 64 + 1);
+        if (first == last)
+        {
+            firstMask &= lastMask;
+            lastMask = firstMask;
+        }
+
+        // Up to 4096 columns the words between first and last are one summary word to test
+        bool singleSummary = summaryPerRow == 1;
+        uint64_t middleMask = first + 1 < last ? lowMask(last) & (~0ull << (first + 1)) : 0;
+        for (int y = y0; y < y1; y++)
+        {
+            const uint64_t* row = &cells[y * wordsPerRow];
+            uint64_t hits = (row[first] & firstMask) | (row[last] & lastMask);
+            if (singleSummary)
+            {
+                hits |= summary[y] & middleMask;
+            }
+            else if (!hits && anyBits(&summary[y * summaryPerRow], first + 1, last))
+            {
+                return true;
+            }
+
+            if (hits)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t countInRect(int x0, int y0, int x1, int y1) const
+    {
+        if (!clampRect(x0, y0, x1, y1))
+        {
+            return 0;
+        }
+
+        size_t count = 0;
+        for (int y = y0; y < y1; y++)
+        {
+            if (anyInRow(y))
+            {
+                count += countBits(&cells[y * wordsPerRow], x0, x1);
+            }
+        }
+        return count;
+    }
+
+    inline int getWidth() const
+    {
+        return width;
+    }
+
+    inline int getHeight() const
+    {
+        return height;
+    }
+
+    inline size_t getWordsPerRow() const
+    {
+        return wordsPerRow;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Read-only view of a brick grid for queries that don't need BoxGrid itself. Uniform grids
+// place brick x, y inside the cell centered at position + (x * pitch.x, -y * pitch.y); freeform
+// layouts are a single occupancy row in placement order.
+struct BrickField
+{
+    bool uniform{ true };
+    Vec2 position{ 0.0f, 0.0f };
+    Vec2 pitch{ 0.0f, 0.0f };
+    int countX{ 0 };
+    int countY{ 0 };
+    const std::vector<Aabb>* layout{ nullptr };
+    const std::vector<uint8_t>* states{ nullptr };
+    const OccupancyBitmap* occupancy{ nullptr };
+    const BrickBvh* bvh{ nullptr };
+};
+
+struct RayHit
+{
+    size_t index{ 0 };
+    float t{ INFINITY };
+};
+
+// Entry distance of origin + t * direction into 'box' grown by 'halfExtent', only for rays that
+// start outside and enter within [0, maxT]. tEnter is written either way.
+inline bool raycastBox(Vec2 origin, Vec2 inverseDirection, const Aabb& box, float halfExtent, float maxT, float& tEnter)
+{
+    float x0 = (box.min.x - halfExtent - origin.x) * inverseDirection.x;
+    float x1 = (box.max.x + halfExtent - origin.x) * inverseDirection.x;
+    float y0 = (box.min.y - halfExtent - origin.y) * inverseDirection.y;
+    float y1 = (box.max.y + halfExtent - origin.y) * inverseDirection.y;
+    float enter = std::max(std::min(x0, x1), std::min(y0, y1));
+    float exit = std::min(std::max(x0, x1), std::max(y0, y1));
+
+    // Evaluated without branches, random rays would mispredict them
+    tEnter = enter;
+    return (enter >= 0.0f) & (enter <= exit) & (enter <= maxT);
+}
+
+// Sweeps a square of half size 'halfExtent' from 'origin' along 'direction' (both components
+// non-zero) and finds the first alive brick it touches within maxT for which accept(index)
+// holds. Freeform layouts descend the BVH. Uniform grids walk the cells under the ray with a
+// DDA; with the square no wider than a cell, a grown brick reaches at most one cell into its
+// neighbours, so the alive bricks of each visited cell's 3x3 neighbourhood are tested, read
+// as bits from the occupancy bitmap. A step only adds the row or column of cells entering the
+// neighbourhood, without the cells behind the ray the square can no longer reach. The walk
+// stops once the best hit lies within the current cell. Wider squares use the BVH as well.
+template<typename Accept>
+bool raycastBricks(const BrickField& field, Vec2 origin, Vec2 direction, float halfExtent, float maxT, const Accept& accept, RayHit& hit)
+{
+    const std::vector<Aabb>& layout = *field.layout;
+    const OccupancyBitmap& occupancy = *field.occupancy;
+    const Vec2 inverse{ 1.0f / direction.x, 1.0f / direction.y };
+
+    hit = RayHit{};
+    auto test = [&](size_t idx)
+    {
+        float t = 0.0f;
+        if (raycastBox(origin, inverse, layout[idx], halfExtent, std::min(maxT, hit.t), t) && accept(idx))
+        {
+            hit.index = idx;
+            hit.t = t;
+        }
+    };
+
+    // Freeform layouts have no cells, and a square wider than a cell reaches past the 3x3
+    // neighbourhood the walk below tests
+    if (!field.uniform || halfExtent > std::min(field.pitch.x, field.pitch.y))
+    {
+        field.bvh->raycast(origin, inverse, halfExtent, [&] { return std::min(maxT, hit.t); }, test);
+        return hit.t != INFINITY;
+    }
+
+    // Top left corner of cell 0, 0, rows grow downwards. Nothing outside the grid grown by a
+    // cell on every side can be hit, rays starting outside of it skip ahead.
+    const Vec2 pitch = field.pitch;
+    const Vec2 corner{ field.position.x - pitch.x / 2, field.position.y + pitch.y / 2 };
+    const Aabb reach{ Vec2{ corner.x - pitch.x, corner.y - (field.countY + 1) * pitch.y }, Vec2{ corner.x + (field.countX + 1) * pitch.x, corner.y + pitch.y } };
+
+    float tStart = 0.0f;
+    bool inside = origin.x >= reach.min.x && origin.x <= reach.max.x && origin.y >= reach.min.y && origin.y <= reach.max.y;
+    if (!inside && !raycastBox(origin, inverse, reach, 0.0f, maxT, tStart))
+    {
+        return false;
+    }
+
+    Vec2 start{ origin.x + direction.x * tStart, origin.y + direction.y * tStart };
+    // Clamped to [-1, count] first, truncating after the shift by one then floors
+    int cx = static_cast<int>(std::clamp((start.x - corner.x) / pitch.x, -1.0f, static_cast<float>(field.countX)) + 1.0f) - 1;
+    int cy = static_cast<int>(std::clamp((corner.y - start.y) / pitch.y, -1.0f, static_cast<float>(field.countY)) + 1.0f) - 1;
+    const int stepX = direction.x > 0.0f ? 1 : -1;
+    const int stepY = direction.y > 0.0f ? -1 : 1;
+
+    float tMaxX = (corner.x + (cx + (stepX > 0)) * pitch.x - origin.x) * inverse.x;
+    float tMaxY = (corner.y - (cy + (stepY > 0)) * pitch.y - origin.y) * inverse.y;
+    const float tDeltaX = pitch.x * std::abs(inverse.x);
+    const float tDeltaY = pitch.y * std::abs(inverse.y);
+
+    // Neighbourhood cells as bits, three per row
+    constexpr uint64_t left = 0b001001001;
+    constexpr uint64_t middleColumn = 0b010010010;
+    constexpr uint64_t right = 0b100100100;
+    constexpr uint64_t top = 0b000000111;
+    constexpr uint64_t middleRow = 0b000111000;
+    constexpr uint64_t bottom = 0b111000000;
+    const uint64_t aheadX = stepX > 0 ? right : left;
+    const uint64_t behindX = stepX > 0 ? left : right;
+    const uint64_t aheadY = stepY > 0 ? bottom : top;
+    const uint64_t behindY = stepY > 0 ? top : bottom;
+
+    // The ray only moves away from the neighbours behind it, they matter only if the square
+    // still reaches past that edge of the current cell when they come into the neighbourhood
+    auto behindColumn = [&](float x)
+    {
+        float edge = corner.x + (cx + (stepX < 0)) * pitch.x;
+        return (x - edge) * stepX < halfExtent ? behindX : 0;
+    };
+    auto behindRow = [&](float y)
+    {
+        float edge = corner.y - (cy + (stepY < 0)) * pitch.y;
+        return (edge - y) * stepY < halfExtent ? behindY : 0;
+    };
+
+    uint64_t entering = (middleColumn | aheadX | behindColumn(start.x)) & (middleRow | aheadY | behindRow(start.y));
+    for (;;)
+    {
+        for (uint64_t bits = occupancy.getBlock3x3(cx - 1, cy - 1) & entering; bits; bits &= bits - 1)
+        {
+            int cell = std::countr_zero(bits);
+            test(static_cast<size_t>(cy - 1 + cell / 3) * field.countX + cx - 1 + cell % 3);
+        }
+
+        float tExit = std::min(tMaxX, tMaxY);
+        if (hit.t <= tExit || tExit > maxT)
+        {
+            break;
+        }
+
+        // A step brings in the row or column ahead, minus the cells behind the ray
+        if (tMaxX < tMaxY)
+        {
+            float y = origin.y + direction.y * tMaxX;
+            cx += stepX;
+            tMaxX += tDeltaX;
+            entering = aheadX & (middleRow | aheadY | behindRow(y));
+        }
+        else
+        {
+            float x = origin.x + direction.x * tMaxY;
+            cy += stepY;
+            tMaxY += tDeltaY;
+            entering = aheadY & (middleColumn | aheadX | behindColumn(x));
+        }
+
+        if (cx < -1 || cx > field.countX || cy < -1 || cy > field.countY)
+        {
+            break;
+        }
+    }
+    return hit.t != INFINITY;
+}
+
+// Explosive bricks waiting to go off, kept by the owner so chain reactions don't allocate.
+// Bricks of the same occupancy word merge into one entry while they wait, so a wave of
+// blasts through a row is spread a word at a time instead of a brick at a time.
+class BlastQueue
+{
+private:
+    size_t wordsPerRow{ 0 };
+    std::vector<uint64_t> pending;
+    std::vector<uint32_t> words;
+    size_t head{ 0 };
+    size_t spreadCount{ 0 };
+
+public:
+    void reset(const OccupancyBitmap& occupancy)
+    {
+        wordsPerRow = occupancy.getWordsPerRow();
+        pending.assign(wordsPerRow * occupancy.getHeight(), 0);
+        words.clear();
+        head = 0;
+        spreadCount = 0;
+    }
+
+    void push(int y, size_t word, uint64_t bits)
+    {
+        uint64_t& waiting = pending[y * wordsPerRow + word];
+        if (!waiting)
+        {
+            words.push_back(static_cast<uint32_t>(y * wordsPerRow + word));
+        }
+        waiting |= bits;
+    }
+
+    bool pop(int& y, size_t& word, uint64_t& bits)
+    {
+        if (head == words.size())
+        {
+            words.clear();
+            head = 0;
+            return false;
+        }
+
+        uint32_t index = words[head++];
+        spreadCount++;
+        y = static_cast<int>(index / wordsPerRow);
+        word = index % wordsPerRow;
+        bits = std::exchange(pending[index], 0);
+        return true;
+    }
+
+    // Number of word blasts spread since the last reset
+    size_t getSpreadCount() const
+    {
+        return spreadCount;
+    }
+};
+
+// Chain reaction as a flood fill over the occupancy bitmap. A blast covers the 3x3 cells
+// around its brick, which for a whole word of explosives is the word and its shifts in the
+// row above, the row itself and the row below, plus the bits carried into the neighbouring
+// words. The word's own row is followed to the end first, so a blast running along a row
+// crosses each word once. resolve(y, word, cells) destroys the given occupied cells, clears
+// them from the bitmap and returns the ones that explode in turn, so every brick is resolved
+// once.
+template<typename Resolve>
+void floodBlasts(const OccupancyBitmap& occupancy, BlastQueue& queue, const Resolve& resolve)
+{
+    const size_t wordsPerRow = occupancy.getWordsPerRow();
+    auto reach = [&](int y, size_t word, uint64_t mask)
+    {
+        uint64_t cells = occupancy.getWord(y, word) & mask;
+        if (cells)
+        {
+            uint64_t exploding = resolve(y, word, cells);
+            if (exploding)
+            {
+                queue.push(y, word, exploding);
+            }
+        }
+    };
+
+    int row = 0;
+    size_t word = 0;
+    uint64_t bits = 0;
+    while (queue.pop(row, word, bits))
+    {
+        for (uint64_t front = bits; front;)
+        {
+            uint64_t cells = occupancy.getWord(row, word) & (front | (front << 1) | (front >> 1));
+            front = cells ? resolve(row, word, cells) : 0;
+            bits |= front;
+        }
+
+        uint64_t spread = bits | (bits << 1) | (bits >> 1);
+        uint64_t intoPrevious = bits << 63;
+        uint64_t intoNext = bits >> 63;
+        for (int y = std::max(row - 1, 0); y <= std::min(row + 1, occupancy.getHeight() - 1); y++)
+        {
+            if (y != row)
+            {
+                reach(y, word, spread);
+            }
+            if (intoPrevious && word > 0)
+            {
+                reach(y, word - 1, intoPrevious);
+            }
+            if (intoNext && word + 1 < wordsPerRow)
+            {
+                reach(y, word + 1, intoNext);
+            }
+        }
+    }
+}
+#pragma endregion COLLISION
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- SCHEDULING --------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region SCHEDULING
+using TimerCallback = void(*)(void* context, uint32_t payload);
+
+// Identifies a scheduled timer, stale ids of fired or cancelled timers are safely ignored
+struct TimerId
+{
+    uint32_t index{ ~0u };
+    uint32_t generation{ 0 };
+};
+
+// Hierarchical timing wheel with four levels of 256 slots over millisecond ticks. Timers sit
+// in intrusive lists of pooled nodes, so scheduling, cancelling and firing are O(1) and only
+// the next 256 ticks are ever looked at. Timers further out are cascaded down a level each
+// time the level below wraps around.
+class TimerWheel
+{
+public:
+    static constexpr double tickDuration = 0.001;
+    // About 49.7 days, the longest delay the levels below can hold
+    static constexpr uint64_t maxDelayTicks = 0xffffffffull;
+
+private:
+    static constexpr uint32_t slotBits = 8;
+    static constexpr uint32_t slotCount = 1u << slotBits;
+    static constexpr uint32_t slotMask = slotCount - 1;
+    static constexpr uint32_t levelCount = 4;
+    static_assert(maxDelayTicks == (uint64_t(1) << (levelCount * slotBits)) - 1);
+    static constexpr uint32_t invalid = ~0u;
+
+    struct Node
+    {
+        uint64_t expires{ 0 };
+        TimerCallback callback{ nullptr };
+        void* context{ nullptr };
+        uint32_t payload{ 0 };
+        uint32_t generation{ 0 };
+        uint32_t prev{ invalid };
+        uint32_t next{ invalid };
+        // Slot list the node is linked into, 'invalid' while the node is free
+        uint32_t slot{ invalid };
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    std::array<uint32_t, slotCount * levelCount> slots;
+
+    uint64_t now = 0;
+    double accumulator = 0.0;
+    size_t activeCount = 0;
+
+public:
+    TimerWheel(size_t initialCapacity = 256)
+    {
+        slots.fill(invalid);
+        reserve(initialCapacity);
+    }
+
+    void reserve(size_t capacity)
+    {
+        nodes.reserve(capacity);
+        freeNodes.reserve(capacity);
+    }
+
+    // Delays are clamped to [1, maxDelayTicks] ticks, the four levels can't tell longer ones
+    // apart. Negative and NaN delays fire on the next tick.
+    TimerId schedule(double delaySeconds, TimerCallback callback, void* context, uint32_t payload = 0)
+    {
+        uint32_t index;
+        if (!freeNodes.empty())
+        {
+            index = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else
+        {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+
+        // Fire on the next tick at the earliest, the current one has already been processed
+        double ticks = std::ceil(delaySeconds / tickDuration);
+        uint64_t delay = ticks >= 1.0 ? static_cast<uint64_t>(std::min(ticks, static_cast<double>(maxDelayTicks))) : 1;
+
+        Node& node = nodes[index];
+        node.expires = now + delay;
+        node.callback = callback;
+        node.context = context;
+        node.payload = payload;
+        link(index);
+        activeCount++;
+
+        return TimerId{ index, node.generation };
+    }
+
+    bool cancel(TimerId id)
+    {
+        if (!isPending(id))
+        {
+            return false;
+        }
+        unlink(id.index);
+        release(id.index);
+        return true;
+    }
+
+    bool isPending(TimerId id) const
+    {
+        return id.index < nodes.size()
+            && nodes[id.index].generation == id.generation
+            && nodes[id.index].slot != invalid;
+    }
+
+    // Converts simulation time into ticks and fires everything that expired along the way
+    void advance(float deltaTime)
+    {
+        accumulator += deltaTime;
+        uint64_t ticks = static_cast<uint64_t>(accumulator / tickDuration);
+        accumulator -= ticks * tickDuration;
+
+        for (uint64_t i = 0; i < ticks; i++)
+        {
+            tick();
+        }
+    }
+
+    void clear()
+    {
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].slot != invalid)
+            {
+                unlink(i);
+                release(i);
+            }
+        }
+        accumulator = 0.0;
+    }
+
+    size_t getActiveCount() const
+    {
+        return activeCount;
+    }
+
+private:
+    void tick()
+    {
+        now++;
+
+        // Refill the lower levels once they wrap around, top down so that timers cascading
+        // from a higher level still get redistributed by the level below in the same tick
+        uint32_t wrapped = 0;
+        while (wrapped + 1 < levelCount && (now & ((uint64_t(1) << ((wrapped + 1) * slotBits)) - 1)) == 0)
+        {
+            wrapped++;
+        }
+        for (uint32_t level = wrapped; level > 0; level--)
+        {
+            cascade(level * slotCount + static_cast<uint32_t>((now >> (level * slotBits)) & slotMask));
+        }
+
+        // Pop one node at a time, callbacks may schedule or cancel other timers
+        uint32_t& head = slots[now & slotMask];
+        while (head != invalid)
+        {
+            uint32_t index = head;
+            Node& node = nodes[index];
+            TimerCallback callback = node.callback;
+            void* context = node.context;
+            uint32_t payload = node.payload;
+
+            unlink(index);
+            release(index);
+            callback(context, payload);
+        }
+    }
+
+    void cascade(uint32_t slot)
+    {
+        uint32_t index = slots[slot];
+        slots[slot] = invalid;
+        while (index != invalid)
+        {
+            uint32_t next = nodes[index].next;
+            link(index);
+            index = next;
+        }
+    }
+
+    void link(uint32_t index)
+    {
+        Node& node = nodes[index];
+        uint64_t delta = node.expires - now;
+
+        uint32_t level = 0;
+        while (level + 1 < levelCount && delta >= (uint64_t(1) << ((level + 1) * slotBits)))
+        {
+            level++;
+        }
+        uint32_t slot = level * slotCount + static_cast<uint32_t>((node.expires >> (level * slotBits)) & slotMask);
+
+        node.slot = slot;
+        node.prev = invalid;
+        node.next = slots[slot];
+        if (node.next != invalid)
+        {
+            nodes[node.next].prev = index;
+        }
+        slots[slot] = index;
+    }
+
+    void unlink(uint32_t index)
+    {
+        Node& node = nodes[index];
+        if (node.prev != invalid)
+        {
+            nodes[node.prev].next = node.next;
+        }
+        else
+        {
+            slots[node.slot] = node.next;
+        }
+        if (node.next != invalid)
+        {
+            nodes[node.next].prev = node.prev;
+        }
+        node.slot = invalid;
+    }
+
+    void release(uint32_t index)
+    {
+        nodes[index].generation++;
+        freeNodes.push_back(index);
+        activeCount--;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Fixed size blocks for coroutine frames. Freed blocks go to a free list and are reused, so
+// once the pool has grown to the peak number of live scripts starting one costs no heap
+// allocation. Frames larger than a block fall back to the global heap and are counted.
+class FramePool
+{
+public:
+    static constexpr size_t blockSize = 512;
+    static constexpr size_t blocksPerChunk = 256;
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    FreeBlock* freeList = nullptr;
+    size_t liveBlocks = 0;
+    size_t oversizedFrames = 0;
+
+public:
+    static FramePool& get()
+    {
+        static FramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size)
+    {
+        if (size > blockSize)
+        {
+            oversizedFrames++;
+            return ::operator new(size);
+        }
+
+        if (!freeList)
+        {
+            grow();
+        }
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        liveBlocks++;
+        return block;
+    }
+
+    void deallocate(void* memory, size_t size)
+    {
+        if (size > blockSize)
+        {
+            ::operator delete(memory);
+            return;
+        }
+
+        FreeBlock* block = static_cast<FreeBlock*>(memory);
+        block->next = freeList;
+        freeList = block;
+        liveBlocks--;
+    }
+
+    size_t getLiveBlocks() const
+    {
+        return liveBlocks;
+    }
+
+    size_t getCapacity() const
+    {
+        return chunks.size() * blocksPerChunk;
+    }
+
+    size_t getOversizedFrames() const
+    {
+        return oversizedFrames;
+    }
+
+private:
+    void grow()
+    {
+        chunks.emplace_back(std::make_unique<std::byte[]>(blockSize * blocksPerChunk));
+        std::byte* chunk = chunks.back().get();
+        for (size_t i = blocksPerChunk; i-- > 0;)
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+            block->next = freeList;
+            freeList = block;
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Coroutine returned by level scripts. It starts suspended, ScriptRunner::start kicks it off
+// and the runner resumes it whenever the awaited tick, time or game event arrives.
+class ScriptTask
+{
+public:
+    struct promise_type
+    {
+        std::exception_ptr exception;
+
+        static void* operator new(size_t size)
+        {
+            return FramePool::get().allocate(size);
+        }
+
+        static void operator delete(void* memory, size_t size)
+        {
+            FramePool::get().deallocate(memory, size);
+        }
+
+        ScriptTask get_return_object()
+        {
+            return ScriptTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        // Stay suspended at the end so the runner can see the task is done and free it
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {}
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit ScriptTask(std::coroutine_handle<promise_type> handle)
+        :   handle(handle)
+    {}
+
+public:
+    ScriptTask() = default;
+
+    ~ScriptTask()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    ScriptTask(const ScriptTask&) = delete;
+    ScriptTask& operator=(const ScriptTask&) = delete;
+
+    ScriptTask(ScriptTask&& other) noexcept
+        :   handle(other.handle)
+    {
+        other.handle = nullptr;
+    }
+
+    ScriptTask& operator=(ScriptTask&& other) noexcept
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+        handle = other.handle;
+        other.handle = nullptr;
+        return *this;
+    }
+
+    bool isDone() const
+    {
+        return !handle || handle.done();
+    }
+
+    std::coroutine_handle<promise_type> getHandle() const
+    {
+        return handle;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+enum class ScriptEvent : uint8_t
+{
+    BrickDestroyed,
+    BallLost,
+    PowerUpCollected,
+    Count
+};
+
+// Owns running level scripts and resumes them from the tick loop. All wait lists are plain
+// vectors that keep their capacity, so suspending and resuming never allocates.
+class ScriptRunner
+{
+private:
+    struct TickWaiter
+    {
+        uint64_t wakeTick;
+        std::coroutine_handle<> handle;
+    };
+
+    std::vector<ScriptTask> tasks;
+    std::vector<TickWaiter> tickWaiters;
+    std::array<std::vector<std::coroutine_handle<>>, static_cast<size_t>(ScriptEvent::Count)> eventWaiters;
+    std::vector<std::coroutine_handle<>> ready;
+    std::vector<std::coroutine_handle<>> resuming;
+
+    TimerWheel timers;
+    uint64_t currentTick = 0;
+
+public:
+    struct WaitTicks
+    {
+        ScriptRunner& runner;
+        uint64_t ticks;
+
+        bool await_ready() const noexcept
+        {
+            return ticks == 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            runner.tickWaiters.push_back(TickWaiter{ runner.currentTick + ticks, handle });
+        }
+
+        void await_resume() const noexcept
+        {}
+    };
+
+    struct WaitSeconds
+    {
+        ScriptRunner& runner;
+        double seconds;
+        std::coroutine_handle<> handle;
+
+        bool await_ready() const noexcept
+        {
+            return seconds <= 0.0;
+        }
+
+        // The awaiter lives in the suspended frame, so the timer can point straight at it
+        void await_suspend(std::coroutine_handle<> suspended)
+        {
+            handle = suspended;
+            runner.timers.schedule(seconds, &WaitSeconds::onExpired, this);
+        }
+
+        void await_resume() const noexcept
+        {}
+
+        static void onExpired(void* context, uint32_t)
+        {
+            auto* self = static_cast<WaitSeconds*>(context);
+            self->runner.ready.push_back(self->handle);
+        }
+    };
+
+    struct WaitEvent
+    {
+        ScriptRunner& runner;
+        ScriptEvent event;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            runner.eventWaiters[static_cast<size_t>(event)].push_back(handle);
+        }
+
+        void await_resume() const noexcept
+        {}
+    };
+
+    ScriptRunner(size_t expectedScripts = 64)
+    {
+        tasks.reserve(expectedScripts);
+        tickWaiters.reserve(expectedScripts);
+        ready.reserve(expectedScripts);
+        resuming.reserve(expectedScripts);
+        for (auto& waiters : eventWaiters)
+        {
+            waiters.reserve(expectedScripts);
+        }
+        timers.reserve(expectedScripts);
+    }
+
+    WaitTicks waitTicks(uint64_t ticks)
+    {
+        return WaitTicks{ *this, ticks };
+    }
+
+    WaitSeconds waitSeconds(double seconds)
+    {
+        return WaitSeconds{ *this, seconds, {} };
+    }
+
+    WaitEvent waitEvent(ScriptEvent event)
+    {
+        return WaitEvent{ *this, event };
+    }
+
+    // Runs the script up to its first wait
+    void start(ScriptTask task)
+    {
+        ready.push_back(task.getHandle());
+        tasks.push_back(std::move(task));
+    }
+
+    void signal(ScriptEvent event)
+    {
+        auto& waiters = eventWaiters[static_cast<size_t>(event)];
+        ready.insert(ready.end(), waiters.begin(), waiters.end());
+        waiters.clear();
+    }
+
+    // One simulation tick: wake due scripts, resume everything that is ready, drop finished ones
+    void update(float deltaTime)
+    {
+        currentTick++;
+        timers.advance(deltaTime);
+
+        for (size_t i = 0; i < tickWaiters.size();)
+        {
+            if (tickWaiters[i].wakeTick <= currentTick)
+            {
+                ready.push_back(tickWaiters[i].handle);
+                tickWaiters[i] = tickWaiters.back();
+                tickWaiters.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        // Scripts resumed here may become ready again, those run next tick
+        std::swap(ready, resuming);
+        for (auto handle : resuming)
+        {
+            handle.resume();
+        }
+        resuming.clear();
+
+        for (size_t i = 0; i < tasks.size();)
+        {
+            if (tasks[i].isDone())
+            {
+                std::exception_ptr exception = tasks[i].getHandle().promise().exception;
+                tasks[i] = std::move(tasks.back());
+                tasks.pop_back();
+                if (exception)
+                {
+                    std::rethrow_exception(exception);
+                }
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    // Destroys every script, pending timers go first since they point into the frames
+    void clear()
+    {
+        timers.clear();
+        tickWaiters.clear();
+        for (auto& waiters : eventWaiters)
+        {
+            waiters.clear();
+        }
+        ready.clear();
+        tasks.clear();
+    }
+
+    size_t getScriptCount() const
+    {
+        return tasks.size();
+    }
+};
+#pragma endregion SCHEDULING
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- GAME OBJECTS ------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region GAME OBJECTS
+class Quad : public IRefCounted
+{
+    Ref<VertexArray> vao;
+    Ref<Buffer> vbo;
+    Ref<Buffer> ibo;
+    Ref<Shader> shader;
+
+    Vec2 position{ 0.0f, -0.5f };
+    Vec2 size{ 1.0f, 0.2f };
+
+    // Position the vertices were generated around
+    Vec2 origin{ 0.0f, 0.0f };
+
+    const AtlasRegion* sprite{ nullptr };
+
+public:
+    Quad(Vec2 position, Vec2 size, const Ref<Shader>& shader)
+        : shader(shader), position(position), size(size), origin(position)
+    {
+        std::vector<Vertex> vertices = generateVertices();
+
+        std::vector<GLuint> indices =
+        {
+            0,1,3,3,1,2
+        };
+
+        vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_STATIC_DRAW, vertices);
+        ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
+
+        vao = Ref<VertexArray>::make();
+
+        std::vector<VertexArray::LayoutElem> layout = {
+            {0, 2, GL_FLOAT, false, sizeof(Vertex), 0}
+        };
+
+        vao->bindVertexBuffer(vbo.get());
+        vao->bindIndexBuffer(ibo.get());
+        vao->bindLayout(layout);
+    }
+
+    void draw(const Mat4& projection)
+    {
+        Mat4 modelMatrix = glm::identity<Mat4>();
+        modelMatrix = glm::translate(modelMatrix, glm::vec3(position, 1.0f));
+
+        glBindVertexArray(vao->getId());
+        glUseProgram(shader->getId());
+        shader->setProjectionMatrix(projection);
+        shader->setModelMatrix(modelMatrix);
+        if (sprite)
+        {
+            SpriteAtlas::apply(*shader, *sprite);
+        }
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+    }
+
+    void setSprite(const AtlasRegion& region)
+    {
+        sprite = &region;
+    }
+
+    Vec2 getSize() const
+    {
+        return size;
+    }
+
+    Vec2 getPosition() const
+    {
+        return position;
+    }
+
+    void moveX(float amount)
+    {
+        float clamp = 2.0f - (size.x / 2.0f);
+
+        position.x += amount;
+        position.x = glm::clamp(position.x, -clamp, clamp);
+    }
+
+    void moveY(float amount)
+    {
+        float clamp = 1.5f - (size.y / 2.0f);
+
+        position.y += amount;
+        position.y = glm::clamp(position.y, -clamp - 1.0f, clamp);
+    }
+
+    void setPosition(Vec2 newPosition)
+    {
+        position = newPosition;
+    }
+
+    // Rewrites the existing vertex buffer, no GL objects are created
+    void resize(Vec2 newSize)
+    {
+        size = newSize;
+        std::vector<Vertex> vertices = generateVertices();
+        vbo->update(0, vertices.data(), vertices.size());
+        moveX(0.0f);
+    }
+
+private:
+    std::vector<Vertex> generateVertices() const
+    {
+        return {
+            Vertex({origin.x - size.x / 2, origin.y + size.y / 2}),
+            Vertex({origin.x - size.x / 2, origin.y - size.y / 2}),
+            Vertex({origin.x + size.x / 2, origin.y - size.y / 2}),
+            Vertex({origin.x + size.x / 2, origin.y + size.y / 2}),
+        };
+    }
+};
+
+class PlayerPlatform : public IRefCounted
+{
+private:
+    Quad quad;
+
+public:
+    PlayerPlatform(Vec2 position, Vec2 size, const Ref<Shader>& shader)
+        : quad(position, size, shader)
+    {
+        quad.setSprite(SpriteAtlas::getRegion("paddle"));
+    }
+
+    void draw(const Mat4& projection)
+    {
+        quad.draw(projection);
+    }
+
+    void move(float direction, float speed)
+    {
+        quad.moveX(direction * speed);
+    }
+
+    Vec2 getPosition() const
+    {
+        return quad.getPosition();
+    }
+
+    Vec2 getSize() const
+    {
+        return quad.getSize();
+    }
+
+    void setWidth(float width)
+    {
+        quad.resize(Vec2{ width, quad.getSize().y });
+    }
+
+    // The paddle is drawn offset from its logical position, this is where it actually collides
+    Aabb getHitBox() const
+    {
+        constexpr float collisionBias = 0.6f;
+        return Aabb::fromCenter(getPosition() - Vec2{ 0.0f, collisionBias }, getSize() / 2.0f);
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Materials are mirrored by the palette in box.frag, keep both in the same order
+enum class BrickMaterial : uint8_t
+{
+    Standard,
+    Reinforced,
+    Armored,
+    Indestructible,
+    // Destroys the bricks around it when it goes, which may set off further explosive bricks
+    Explosive,
+    Count
+};
+
+// Every brick is described by a single byte: material in the high nibble, hit points in the
+// low nibble. Zero hit points means the brick is gone.
+struct BrickState
+{
+    static constexpr std::array<uint8_t, static_cast<size_t>(BrickMaterial::Count)> maxHitPoints = { 1, 2, 3, 15, 1 };
+
+    static uint8_t make(BrickMaterial material)
+    {
+        return make(material, maxHitPoints[static_cast<size_t>(material)]);
+    }
+
+    static uint8_t make(BrickMaterial material, uint8_t hitPoints)
+    {
+        return static_cast<uint8_t>((static_cast<uint8_t>(material) << 4) | (hitPoints & 0x0F));
+    }
+
+    static BrickMaterial getMaterial(uint8_t state)
+    {
+        return static_cast<BrickMaterial>(state >> 4);
+    }
+
+    static uint8_t getHitPoints(uint8_t state)
+    {
+        return state & 0x0F;
+    }
+
+    static bool isAlive(uint8_t state)
+    {
+        return getHitPoints(state) != 0;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+class BoxGrid : public IRefCounted
+{
+public:
+    struct Box
+    {
+        Vertex topLeft;
+        Vertex bottomLeft;
+        Vertex bottomRight;
+        Vertex topRight;
+
+        bool hit(Vec2 position, Vec2 size, float collisionBias) const
+        {
+            if (position.x - collisionBias < topRight.position.x
+                && position.x + collisionBias > topLeft.position.x
+                && position.y - collisionBias < topLeft.position.y
+                && position.y + collisionBias > bottomRight.position.y)
+            {
+                return true;
+            }
+            return false;
+        }
+    };
+
+    enum class HitResult
+    {
+        Deflected,
+        Damaged,
+        Destroyed,
+    };
+
+    // BVH nodes refit per tick while a chain reaction too large to refit at once settles
+    static constexpr size_t bvhRefitSlice = 1 << 16;
+
+private:
+    // Creates the buffers on the upload context, the grid keeps drawing its previous buffers
+    // until complete() hands the new ones over
+    class UploadJob : public IUploadJob
+    {
+    public:
+        BoxGrid* grid;
+        std::vector<Box> storage;
+        std::vector<GLuint> indices;
+        std::vector<uint8_t> stateStorage;
+
+        Ref<Buffer> vbo;
+        Ref<Buffer> ibo;
+        Ref<Buffer> stateBuffer;
+
+        UploadJob(BoxGrid* grid, std::vector<Box> storage, std::vector<GLuint> indices, std::vector<uint8_t> stateStorage)
+            :   grid(grid), storage(std::move(storage)), indices(std::move(indices)), stateStorage(std::move(stateStorage))
+        {}
+
+        void run() override
+        {
+            vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, storage);
+            ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
+            stateBuffer = Ref<Buffer>::make(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW, stateStorage);
+
+            storage = {};
+            indices = {};
+            stateStorage = {};
+        }
+
+        void complete() override
+        {
+            if (grid)
+            {
+                grid->finishUpload(*this);
+            }
+        }
+    };
+
+    Ref<VertexArray> vao;
+    Ref<Buffer>  vbo;
+    Ref<Buffer> ibo;
+
+    // One byte per brick, read by box.vert and box.frag as a storage buffer
+    Ref<Buffer> stateBuffer;
+
+    // Without an uploader the buffers are created synchronously
+    GpuUploader* uploader{ nullptr };
+    Ref<UploadJob> pendingUpload;
+
+    // Edits made while an upload is in flight are applied once it lands
+    bool dirtySinceUpload = false;
+
+    Ref<Shader> shader;
+    const AtlasRegion* sprite{ &SpriteAtlas::getRegion("brick") };
+    std::vector<Box> vertices;
+
+    Vec2 position{ 0.0f, 0.0f };
+    Vec2 boxSize{ 0.0f, 0.0f };
+    float margin{ 0.0f };
+    int countX{ 0 };
+    int countY{ 0 };
+    bool uniform{ true };
+
+    std::vector<Aabb> layout;
+    std::vector<uint8_t> states;
+    size_t destructibleCount = 0;
+    BrickBvh bvh;
+
+    // Thinnest brick side ever placed, only shrinks so it stays conservative after edits
+    float minExtent = INFINITY;
+
+    // Alive bricks by cell, freeform layouts are a single row in placement order
+    OccupancyBitmap occupancy;
+
+    BlastQueue blastQueue;
+
+    // Number of boxes the GPU buffers have room for, edits within it only patch the buffer
+    size_t boxCapacity = 0;
+    size_t indexCount = 0;
+
+public:
+    BoxGrid(const Ref<Shader>& shader, GpuUploader* uploader, Vec2 position, Vec2 boxSize = Vec2(0.5f, 0.5f), float margin = 0.01f, int countX = 10, int countY = 3)
+        :   uploader(uploader), shader(shader), position(position), boxSize(boxSize), margin(margin), countX(countX), countY(countY)
+    {
+        setLayout(generateLayout(position, boxSize, margin, countX, countY));
+    }
+
+    // Freeform layout with arbitrary brick positions and sizes
+    BoxGrid(const Ref<Shader>& shader, GpuUploader* uploader, std::vector<Aabb> bricks)
+        :   uploader(uploader), shader(shader), countX(static_cast<int>(bricks.size())), countY(1), uniform(false)
+    {
+        setLayout(std::move(bricks));
+    }
+
+    ~BoxGrid()
+    {
+        if (pendingUpload.get())
+        {
+            pendingUpload->grid = nullptr;
+        }
+    }
+
+    BoxGrid(const BoxGrid&) = delete;
+    BoxGrid& operator=(const BoxGrid&) = delete;
+
+    void regenerate()
+    {
+        // Keep the state buffer a whole number of uints for the shader
+        boxCapacity = (std::max<size_t>(boxCapacity, layout.size()) + 3) & ~size_t(3);
+        vertices = generateVertices();
+        auto indices = generateIndices(boxCapacity);
+
+        // Spare capacity has zero hit points, so freeform edits can append in place
+        std::vector<Box> storage = vertices;
+        storage.resize(boxCapacity, hiddenBox());
+        std::vector<uint8_t> stateStorage = states;
+        stateStorage.resize(boxCapacity, 0);
+
+        if (uploader)
+        {
+            // A newer rebuild supersedes one still in flight
+            if (pendingUpload.get())
+            {
+                pendingUpload->grid = nullptr;
+            }
+            pendingUpload = Ref<UploadJob>::make(this, std::move(storage), std::move(indices), std::move(stateStorage));
+            dirtySinceUpload = false;
+            uploader->submit(pendingUpload);
+            return;
+        }
+
+        vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, storage);
+        ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
+        stateBuffer = Ref<Buffer>::make(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW, stateStorage);
+        createVertexArray();
+    }
+
+    bool isUploading() const
+    {
+        return pendingUpload.get() != nullptr;
+    }
+
+    static std::vector<Aabb> generateLayout(Vec2 position, Vec2 boxSize, float margin, int countX, int countY)
+    {
+        float lastX = position.x;
+        float lastY = position.y;
+
+        std::vector<Aabb> bricks;
+        bricks.reserve(static_cast<size_t>(countX) * countY);
+
+        for (int y = 0; y < countY; y++)
+        {
+            for (int x = 0; x < countX; x++)
+            {
+                bricks.emplace_back(Aabb::fromCenter(Vec2{ lastX, lastY }, boxSize / 2.0f));
+                lastX += margin + boxSize.x;
+            }
+            lastY -= margin + boxSize.y;
+            lastX = position.x;
+        }
+
+        return bricks;
+    }
+
+    std::vector<Box> generateVertices()
+    {
+        std::vector<Box> vertices;
+        vertices.reserve(layout.size());
+
+        for (const auto& brick : layout)
+        {
+            vertices.emplace_back(makeBox(brick));
+        }
+
+        return vertices;
+    }
+
+    std::vector<GLuint> generateIndices(size_t vertexCount)
+    {
+        std::vector<GLuint> indices;
+        indices.reserve(vertexCount * 6);
+
+        GLuint lastIdx = 0;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            indices.emplace_back(lastIdx);
+            indices.emplace_back(lastIdx + 1);
+            indices.emplace_back(lastIdx + 3);
+            indices.emplace_back(lastIdx + 3);
+            indices.emplace_back(lastIdx + 1);
+            indices.emplace_back(lastIdx + 2);
+            lastIdx += 4;
+        }
+
+        return indices;
+    }
+
+    void draw(const Mat4& projection)
+    {
+        // Nothing to draw until the first upload lands
+        if (!vao.get())
+        {
+            return;
+        }
+
+        glBindVertexArray(vao->getId());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, stateBuffer->getId());
+        glUseProgram(shader->getId());
+        shader->setProjectionMatrix(projection);
+        shader->setModelMatrix(glm::identity<glm::mat4>());
+        SpriteAtlas::apply(*shader, *sprite);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT, nullptr);
+    }
+
+    const std::vector<Box>& getBoxes() const
+    {
+        return vertices;
+    }
+
+    const std::vector<Aabb>& getLayout() const
+    {
+        return layout;
+    }
+
+    bool isUniform() const
+    {
+        return uniform;
+    }
+
+    bool isAlive(size_t idx) const
+    {
+        return BrickState::isAlive(states[idx]);
+    }
+
+    uint8_t getState(size_t idx) const
+    {
+        return states[idx];
+    }
+
+    // Bricks that still have to be destroyed to clear the level
+    size_t getAliveCount() const
+    {
+        return destructibleCount;
+    }
+
+    // Finds the first alive brick overlapping the square of half size 'collisionBias' around 'position'
+    bool findHit(Vec2 position, float collisionBias, size_t& hitIndex) const
+    {
+        return bvh.queryFirst(Aabb::fromCenter(position, Vec2(collisionBias)), hitIndex);
+    }
+
+    // Uniform grids only: the cell under 'point' and its default bounds
+    bool findCell(Vec2 point, size_t& cellIndex, Aabb& cellBounds) const
+    {
+        if (!uniform)
+        {
+            return false;
+        }
+
+        Vec2 pitch = boxSize + Vec2(margin);
+        Vec2 origin{ position.x - pitch.x / 2, position.y + pitch.y / 2 };
+        int x = static_cast<int>(std::floor((point.x - origin.x) / pitch.x));
+        int y = static_cast<int>(std::floor((origin.y - point.y) / pitch.y));
+        if (x < 0 || y < 0 || x >= countX || y >= countY)
+        {
+            return false;
+        }
+
+        cellIndex = static_cast<size_t>(y) * countX + x;
+        cellBounds = Aabb::fromCenter(Vec2{ position.x + x * pitch.x, position.y - y * pitch.y }, boxSize / 2.0f);
+        return true;
+    }
+
+    // Applies one ball hit, which only uploads the brick's state byte
+    HitResult hitBox(size_t idx)
+    {
+        uint8_t state = states[idx];
+        if (BrickState::getMaterial(state) == BrickMaterial::Indestructible)
+        {
+            return HitResult::Deflected;
+        }
+
+        setState(idx, BrickState::make(BrickState::getMaterial(state), BrickState::getHitPoints(state) - 1));
+        return isAlive(idx) ? HitResult::Damaged : HitResult::Destroyed;
+    }
+
+    // Sets off the explosive bricks among 'sources', bricks destroyed this tick, and every
+    // explosive brick their blasts reach. 'destroyed' receives all bricks the chain destroyed,
+    // which reach the GPU as one range of the state buffer instead of a write per brick.
+    // Freeform layouts have no cells to spread across, explosive bricks there only go alone.
+    // Runs once per tick, which also carries the BVH refit of a large chain one slice further.
+    size_t detonate(const std::vector<uint32_t>& sources, std::vector<uint32_t>& destroyed)
+    {
+        bvh.refitSome(bvhRefitSlice);
+        destroyed.clear();
+        if (!uniform)
+        {
+            return 0;
+        }
+
+        auto [first, last] = resolveChainReaction(sources, countX, states, occupancy, blastQueue, destroyed);
+        if (destroyed.empty())
+        {
+            return 0;
+        }
+
+        destructibleCount -= destroyed.size();
+        bvh.removeBatch(destroyed);
+
+        if (isUploading())
+        {
+            dirtySinceUpload = true;
+        }
+        else
+        {
+            stateBuffer->update(first, &states[first], last - first);
+        }
+        return destroyed.size();
+    }
+
+    // The state side of detonate() on a uniform grid 'countX' wide, also run by the benchmark
+    // which has no GL context. Updates 'states' and 'occupancy', appends the destroyed bricks
+    // and returns the [first, last) range of state bytes that changed. Indestructible bricks
+    // survive and stop the blasts.
+    static std::pair<size_t, size_t> resolveChainReaction(const std::vector<uint32_t>& sources, int countX, std::vector<uint8_t>& states,
+        OccupancyBitmap& occupancy, BlastQueue& queue, std::vector<uint32_t>& destroyed)
+    {
+        queue.reset(occupancy);
+        for (uint32_t idx : sources)
+        {
+            uint8_t state = states[idx];
+            if (BrickState::getMaterial(state) == BrickMaterial::Explosive && !BrickState::isAlive(state))
+            {
+                uint32_t x = idx % countX;
+                queue.push(static_cast<int>(idx / countX), x / 64, 1ull << (x % 64));
+            }
+        }
+
+        // A chain can reach every brick, growing 'destroyed' while flooding would copy it repeatedly
+        destroyed.reserve(states.size());
+        size_t first = states.size();
+        size_t last = 0;
+        floodBlasts(occupancy, queue, [&](int y, size_t word, uint64_t cells)
+        {
+            uint64_t cleared = 0;
+            uint64_t exploding = 0;
+            size_t wordStart = static_cast<size_t>(y) * countX + word * 64;
+            for (; cells; cells &= cells - 1)
+            {
+                int bit = std::countr_zero(cells);
+                size_t idx = wordStart + bit;
+                BrickMaterial material = BrickState::getMaterial(states[idx]);
+                if (material == BrickMaterial::Indestructible)
+                {
+                    continue;
+                }
+
+                cleared |= 1ull << bit;
+                exploding |= static_cast<uint64_t>(material == BrickMaterial::Explosive) << bit;
+                states[idx] = BrickState::make(material, 0);
+                destroyed.push_back(static_cast<uint32_t>(idx));
+            }
+
+            if (cleared)
+            {
+                occupancy.clearWord(y, word, cleared);
+                first = std::min(first, wordStart + std::countr_zero(cleared));
+                last = std::max(last, wordStart + 64 - std::countl_zero(cleared));
+            }
+            return exploding;
+        });
+        return { std::min(first, last), last };
+    }
+
+    // Brick placement: uniform grids revive the cell under the brick center, freeform layouts
+    // append a new brick. Returns false if there is nowhere to place it.
+    bool placeBox(const Aabb& bounds, uint8_t state, size_t& idx)
+    {
+        if (uniform)
+        {
+            Aabb cellBounds;
+            if (!findCell(bounds.getCenter(), idx, cellBounds) || isAlive(idx))
+            {
+                return false;
+            }
+            reviveBox(idx, cellBounds, state);
+            return true;
+        }
+
+        idx = bvh.insert(bounds);
+        layout.push_back(bounds);
+        states.push_back(0);
+        minExtent = std::min(minExtent, bounds.getMinExtent());
+        occupancy.growWidth(static_cast<int>(layout.size()));
+
+        if (layout.size() > boxCapacity)
+        {
+            boxCapacity = std::max<size_t>(layout.size(), boxCapacity * 2);
+            regenerate();
+        }
+        else
+        {
+            vertices.push_back(makeBox(bounds));
+            if (isUploading())
+            {
+                dirtySinceUpload = true;
+            }
+            else
+            {
+                indexCount = vertices.size() * 6;
+                vbo->update(idx, &vertices[idx], 1);
+            }
+        }
+
+        setState(idx, state);
+        return true;
+    }
+
+    void reviveBox(size_t idx, const Aabb& bounds, uint8_t state)
+    {
+        if (!(layout[idx] == bounds))
+        {
+            layout[idx] = bounds;
+            patchBox(idx);
+            if (isAlive(idx))
+            {
+                bvh.update(idx, bounds);
+            }
+        }
+        setState(idx, state);
+    }
+
+    void resizeBox(size_t idx, const Aabb& bounds)
+    {
+        layout[idx] = bounds;
+        minExtent = std::min(minExtent, bounds.getMinExtent());
+        bvh.update(idx, bounds);
+        patchBox(idx);
+    }
+
+    void destroyBox(size_t idx)
+    {
+        setState(idx, 0);
+    }
+
+    void setMaterial(size_t idx, BrickMaterial material)
+    {
+        setState(idx, BrickState::make(material));
+    }
+
+    // Uniform grids only: brings back every destroyed brick of a row
+    void respawnRow(int row, BrickMaterial material)
+    {
+        if (!uniform || row < 0 || row >= countY)
+        {
+            return;
+        }
+
+        for (int x = 0; x < countX; x++)
+        {
+            size_t idx = static_cast<size_t>(row) * countX + x;
+            Aabb cellBounds;
+            if (!isAlive(idx) && findCell(layout[idx].getCenter(), idx, cellBounds))
+            {
+                reviveBox(idx, cellBounds, BrickState::make(material));
+            }
+        }
+    }
+
+    int getRowCount() const
+    {
+        return countY;
+    }
+
+    float getMinExtent() const
+    {
+        return minExtent;
+    }
+
+    const OccupancyBitmap& getOccupancy() const
+    {
+        return occupancy;
+    }
+
+    BrickField getField() const
+    {
+        return BrickField{ uniform, position, boxSize + Vec2(margin), countX, countY, &layout, &states, &occupancy, &bvh };
+    }
+
+    bool anyAliveInRow(int row) const
+    {
+        return occupancy.anyInRow(row);
+    }
+
+    // The alive brick closest to the paddle. Uniform grids take the last occupied row, freeform
+    // layouts have no rows and compare brick bottoms.
+    bool findLowestAlive(size_t& idx) const
+    {
+        if (!uniform)
+        {
+            float lowest = INFINITY;
+            for (size_t i = 0; i < layout.size(); i++)
+            {
+                if (isAlive(i) && layout[i].min.y < lowest)
+                {
+                    lowest = layout[i].min.y;
+                    idx = i;
+                }
+            }
+            return lowest != INFINITY;
+        }
+
+        int x = 0;
+        int y = 0;
+        if (!occupancy.findLastRow(y) || !occupancy.findFirstInRow(y, x))
+        {
+            return false;
+        }
+        idx = static_cast<size_t>(y) * countX + x;
+        return true;
+    }
+
+    // Any alive brick touching 'region'. Uniform grids answer at cell granularity from the
+    // occupancy bitmap, freeform layouts go through the BVH.
+    bool anyAliveIn(const Aabb& region) const
+    {
+        if (!uniform)
+        {
+            size_t idx = 0;
+            return bvh.queryFirst(region, idx);
+        }
+
+        Vec2 pitch = boxSize + Vec2(margin);
+        Vec2 origin{ position.x - pitch.x / 2, position.y + pitch.y / 2 };
+        auto toCell = [](float cell, int count) { return static_cast<int>(std::clamp(std::floor(cell), -1.0f, static_cast<float>(count))); };
+        int x0 = toCell((region.min.x - origin.x) / pitch.x, countX);
+        int x1 = toCell((region.max.x - origin.x) / pitch.x, countX) + 1;
+        int y0 = toCell((origin.y - region.max.y) / pitch.y, countY);
+        int y1 = toCell((origin.y - region.min.y) / pitch.y, countY) + 1;
+        return occupancy.anyInRect(x0, y0, x1, y1);
+    }
+
+    // Largest bounds a brick may grow to, uniform grid bricks stay inside their cell
+    Aabb clampBounds(size_t idx, const Aabb& bounds) const
+    {
+        if (!uniform)
+        {
+            return bounds;
+        }
+
+        Vec2 pitch = boxSize + Vec2(margin);
+        Vec2 center{ position.x + (idx % countX) * pitch.x, position.y - (idx / countX) * pitch.y };
+        Aabb cell = Aabb::fromCenter(center, boxSize / 2.0f);
+        return Aabb{ glm::max(bounds.min, cell.min), glm::min(bounds.max, cell.max) };
+    }
+
+private:
+    static Box hiddenBox()
+    {
+        return Box{ Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f}, Vec2{-100.0f, -100.0f} };
+    }
+
+    static Box makeBox(const Aabb& brick)
+    {
+        return Box{
+           .topLeft = Vec2{ brick.min.x, brick.max.y },
+           .bottomLeft = Vec2{ brick.min.x, brick.min.y },
+           .bottomRight = Vec2{ brick.max.x, brick.min.y },
+           .topRight = Vec2{ brick.max.x, brick.max.y } };
+    }
+
+    // Uploads a single box instead of rebuilding the whole vertex buffer
+    void patchBox(size_t idx)
+    {
+        vertices[idx] = makeBox(layout[idx]);
+        if (isUploading())
+        {
+            dirtySinceUpload = true;
+            return;
+        }
+        vbo->update(idx, &vertices[idx], 1);
+    }
+
+    // Keeps the BVH and the level clear counter in sync and uploads the single changed byte
+    void setState(size_t idx, uint8_t state)
+    {
+        uint8_t previous = states[idx];
+        if (previous == state)
+        {
+            return;
+        }
+
+        bool wasAlive = BrickState::isAlive(previous);
+        bool nowAlive = BrickState::isAlive(state);
+        if (wasAlive && !nowAlive)
+        {
+            bvh.remove(idx);
+        }
+        else if (nowAlive && !wasAlive)
+        {
+            bvh.update(idx, layout[idx]);
+        }
+        if (wasAlive != nowAlive)
+        {
+            int width = occupancy.getWidth();
+            occupancy.set(static_cast<int>(idx % width), static_cast<int>(idx / width), nowAlive);
+        }
+
+        destructibleCount -= isDestructible(previous);
+        destructibleCount += isDestructible(state);
+
+        states[idx] = state;
+        if (isUploading())
+        {
+            dirtySinceUpload = true;
+            return;
+        }
+        stateBuffer->update(idx, &states[idx], 1);
+    }
+
+    void createVertexArray()
+    {
+        vao = Ref<VertexArray>::make();
+
+        std::vector<VertexArray::LayoutElem> layout = {
+            {0, 2, GL_FLOAT, false, sizeof(Vertex), 0}
+        };
+
+        vao->bindVertexBuffer(vbo.get());
+        vao->bindIndexBuffer(ibo.get());
+        vao->bindLayout(layout);
+
+        indexCount = vertices.size() * 6;
+    }
+
+    // Main thread, the upload's fence has signalled so its buffers are safe to use here
+    void finishUpload(UploadJob& job)
+    {
+        pendingUpload = {};
+        if (!job.vbo.get() || !job.ibo.get() || !job.stateBuffer.get())
+        {
+            std::cerr << "Brick upload failed, rebuilding on the main thread" << std::endl;
+            uploader = nullptr;
+            regenerate();
+            return;
+        }
+
+        vbo = std::move(job.vbo);
+        ibo = std::move(job.ibo);
+        stateBuffer = std::move(job.stateBuffer);
+        createVertexArray();
+
+        if (dirtySinceUpload)
+        {
+            vbo->update(0, vertices.data(), vertices.size());
+            stateBuffer->update(0, states.data(), states.size());
+            dirtySinceUpload = false;
+        }
+    }
+
+    // Freeform layouts are a single row, placeBox widens it geometrically instead of rebuilding
+    void rebuildOccupancy()
+    {
+        int width = uniform ? countX : std::max(static_cast<int>(layout.size()), 1);
+        int height = uniform ? countY : 1;
+        occupancy.reset(width, height);
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            if (BrickState::isAlive(states[i]))
+            {
+                occupancy.set(static_cast<int>(i % width), static_cast<int>(i / width), true);
+            }
+        }
+    }
+
+    static bool isDestructible(uint8_t state)
+    {
+        return BrickState::isAlive(state) && BrickState::getMaterial(state) != BrickMaterial::Indestructible;
+    }
+
+    void setLayout(std::vector<Aabb> bricks)
+    {
+        layout = std::move(bricks);
+        minExtent = INFINITY;
+        for (const auto& brick : layout)
+        {
+            minExtent = std::min(minExtent, brick.getMinExtent());
+        }
+        states.assign(layout.size(), BrickState::make(BrickMaterial::Standard));
+        rebuildOccupancy();
+        destructibleCount = layout.size();
+        bvh.build(layout);
         regenerate();
     }
-};
+};
+
+
+// -------------------------------------------------------------------------------------------
+enum class PowerUpType : uint8_t
+{
+    Widen,
+    MultiBall,
+    Count
+};
+
+// Power-ups falling from destroyed bricks. All of them live in fixed size arrays packed at the
+// front, are tested against the paddle in one pass and drawn with one instanced call, so
+// spawning and collecting never allocates memory or creates GL objects.
+class PowerUpSystem : public IRefCounted
+{
+public:
+    static constexpr size_t capacity = 64;
+    using Collected = std::array<PowerUpType, capacity>;
+
+private:
+    struct Instance
+    {
+        Vec2 offset;
+        float type;
+    };
+
+    static constexpr Vec2 size{ 0.12f, 0.05f };
+    static constexpr float fallSpeed = 0.6f;
+    static constexpr float spawnChance = 0.25f;
+
+    std::array<float, capacity> xs{};
+    std::array<float, capacity> ys{};
+    std::array<PowerUpType, capacity> types{};
+    size_t count = 0;
+
+    std::array<Instance, capacity> instances{};
+    std::minstd_rand rng{ 42 };
+
+    Ref<VertexArray> vao;
+    Ref<Buffer> vbo;
+    Ref<Buffer> ibo;
+    Ref<Buffer> instanceBuffer;
+    Ref<Shader> shader;
+
+public:
+    PowerUpSystem(const Ref<Shader>& shader)
+        :   shader(shader)
+    {
+        std::vector<Vertex> vertices =
+        {
+            Vertex({-size.x / 2,  size.y / 2}),
+            Vertex({-size.x / 2, -size.y / 2}),
+            Vertex({ size.x / 2, -size.y / 2}),
+            Vertex({ size.x / 2,  size.y / 2}),
+        };
+
+        std::vector<GLuint> indices =
+        {
+            0,1,3,3,1,2
+        };
+
+        vbo = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_STATIC_DRAW, vertices);
+        ibo = Ref<Buffer>::make(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices);
+        instanceBuffer = Ref<Buffer>::make(GL_ARRAY_BUFFER, GL_DYNAMIC_STORAGE_BIT, sizeof(instances));
+
+        vao = Ref<VertexArray>::make();
+
+        std::vector<VertexArray::LayoutElem> layout = {
+            {0, 2, GL_FLOAT, false, sizeof(Vertex), 0, 0},
+            {1, 2, GL_FLOAT, false, sizeof(Instance), offsetof(Instance, offset), 1},
+            {2, 1, GL_FLOAT, false, sizeof(Instance), offsetof(Instance, type), 1},
+        };
+
+        vao->bindVertexBuffer(vbo.get());
+        vao->bindVertexBuffer(instanceBuffer.get(), 1, sizeof(Instance), 1);
+        vao->bindIndexBuffer(ibo.get());
+        vao->bindLayout(layout);
+    }
+
+    bool isFull() const
+    {
+        return count == capacity;
+    }
+
+    // Rolls for a drop at a destroyed brick, silently skipped when the pool is full
+    void trySpawn(Vec2 position)
+    {
+        if (count == capacity || std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) > spawnChance)
+        {
+            return;
+        }
+
+        xs[count] = position.x;
+        ys[count] = position.y;
+        types[count] = static_cast<PowerUpType>(rng() % static_cast<uint32_t>(PowerUpType::Count));
+        count++;
+    }
+
+    // Moves everything down and returns how many power-ups the paddle caught this tick
+    size_t update(float deltaTime, const Aabb& paddle, Collected& collected)
+    {
+        const float fall = fallSpeed * deltaTime;
+        const float minX = paddle.min.x - size.x / 2;
+        const float maxX = paddle.max.x + size.x / 2;
+        const float minY = paddle.min.y - size.y / 2;
+        const float maxY = paddle.max.y + size.y / 2;
+
+        // Branch-free pass over the packed arrays: 1 = caught, 2 = fell out of the world
+        std::array<uint8_t, capacity> outcome;
+        for (size_t i = 0; i < count; i++)
+        {
+            ys[i] -= fall;
+            bool caught = xs[i] > minX && xs[i] < maxX && ys[i] > minY && ys[i] < maxY;
+            bool lost = ys[i] < -1.5f - size.y;
+            outcome[i] = static_cast<uint8_t>(caught | (lost << 1));
+        }
+
+        size_t collectedCount = 0;
+        for (size_t i = count; i-- > 0;)
+        {
+            if (outcome[i] == 0)
+            {
+                continue;
+            }
+            if (outcome[i] & 1)
+            {
+                collected[collectedCount++] = types[i];
+            }
+
+            // Swap with the last live entry to keep the arrays packed
+            count--;
+            xs[i] = xs[count];
+            ys[i] = ys[count];
+            types[i] = types[count];
+        }
+        return collectedCount;
+    }
+
+    void draw(const Mat4& projection)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            instances[i] = Instance{ Vec2{ xs[i], ys[i] }, static_cast<float>(types[i]) };
+        }
+        instanceBuffer->update(0, instances.data(), count);
+
+        glBindVertexArray(vao->getId());
+        glUseProgram(shader->getId());
+        shader->setProjectionMatrix(projection);
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(count));
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Shader hot reload swaps the program, the buffers stay as they are
+    void setShader(const Ref<Shader>& newShader)
+    {
+        shader = newShader;
+    }
+
+    size_t getCount() const
+    {
+        return count;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+enum class HitKind
+{
+    Wall,
+    Paddle,
+    Brick,
+    Explosion
+};
+
+// Brick hits rise a semitone per brick row height, walls tick, the paddle thumps and chain
+// reactions rumble
+SynthPatch makeHitPatch(HitKind kind, float height = 0.0f)
+{
+    SynthPatch patch;
+    switch (kind)
+    {
+    case HitKind::Wall:
+        patch.waveform = Waveform::Triangle;
+        patch.frequency = 330.0f;
+        patch.noise = 0.35f;
+        patch.decay = 0.03f;
+        patch.release = 0.04f;
+        patch.gain = 0.3f;
+        break;
+    case HitKind::Paddle:
+        patch.waveform = Waveform::Sine;
+        patch.frequency = 160.0f;
+        patch.noise = 0.1f;
+        patch.decay = 0.08f;
+        patch.release = 0.1f;
+        break;
+    case HitKind::Brick:
+        patch.waveform = Waveform::Square;
+        patch.frequency = 440.0f * std::exp2(std::round(std::max(height, 0.0f) * 8.0f) / 12.0f);
+        patch.noise = 0.1f;
+        patch.decay = 0.06f;
+        patch.sustain = 0.2f;
+        patch.gain = 0.25f;
+        break;
+    case HitKind::Explosion:
+        patch.waveform = Waveform::Saw;
+        patch.frequency = 55.0f;
+        patch.noise = 0.8f;
+        patch.decay = 0.25f;
+        patch.sustain = 0.3f;
+        patch.release = 0.3f;
+        patch.gain = 0.5f;
+        break;
+    }
+    return patch;
+}
+
+// -------------------------------------------------------------------------------------------
+// One column per field, 'subject' is a brick or ball index depending on the stream
+struct EventStream
+{
+    std::vector<uint32_t> subject;
+    std::vector<Vec2> position;
+
+    void push(uint32_t id, Vec2 at)
+    {
+        subject.push_back(id);
+        position.push_back(at);
+    }
+
+    size_t size() const
+    {
+        return subject.size();
+    }
+
+    void clear()
+    {
+        subject.clear();
+        position.clear();
+    }
+};
+
+// Side effects of a physics tick. Physics only appends to the streams, afterwards each
+// consumer walks the streams it cares about in one batch and the tick ends with clear(),
+// which keeps the capacity so steady play doesn't allocate.
+struct GameEvents
+{
+    // Bricks that were hit and survived, indestructible ones included
+    EventStream brickHit;
+    EventStream brickDestroyed;
+    // Bricks destroyed by explosive bricks going off, resolved once per tick after physics.
+    // Only counted: a chain can take the whole level, and its consumers need the count or at
+    // most the first few bricks of the list BoxGrid::detonate filled.
+    size_t bricksDetonated{ 0 };
+    EventStream wallBounce;
+    EventStream paddleHit;
+    EventStream ballLost;
+
+    void clear()
+    {
+        brickHit.clear();
+        brickDestroyed.clear();
+        bricksDetonated = 0;
+        wallBounce.clear();
+        paddleHit.clear();
+        ballLost.clear();
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+class Ball : public IRefCounted
+{
+private:
+    Quad quad;
+
+    Ref<PlayerPlatform> player;
+    Ref<BoxGrid> grid;
+
+    float selfCollisionBias = 0.02f;
+    bool active = true;
+
+public:
+    Ball(Vec2 position, Vec2 size, const Ref<Shader>& shader, const Ref<PlayerPlatform>& player, const Ref<BoxGrid>& grid)
+        : quad(position, size, shader), player(player), grid(grid)
+    {
+        quad.setSprite(SpriteAtlas::getRegion("ball"));
+    }
+
+    bool isActive() const
+    {
+        return active;
+    }
+
+    void setActive(bool value)
+    {
+        active = value;
+    }
+
+    // Puts the ball back in play at 'position' heading diagonally along 'direction'
+    void launch(Vec2 position, Vec2 direction)
+    {
+        quad.setPosition(position);
+        xStep = direction.x < 0.0f ? -1.0f : 1.0f;
+        yStep = direction.y < 0.0f ? -1.0f : 1.0f;
+        active = true;
+    }
+
+    void draw(const Mat4& projection)
+    {
+        quad.draw(projection);
+    }
+
+    void move(Vec2 direction, float speed)
+    {
+        quad.moveX(direction.x * speed);
+        quad.moveY(direction.y * speed);
+    }
+
+    Vec2 getPosition() const
+    {
+        return quad.getPosition();
+    }
+
+    Vec2 getSize() const
+    {
+        return quad.getSize();
+    }
+
+    Vec2 getDirection() const
+    {
+        return Vec2{ xStep, yStep };
+    }
+
+    // Test code before implementing collision detection
+    float xStep = 1.0f;
+    float yStep = +1.0f;
+    static constexpr uint32_t maxSubsteps = 8;
+
+    // Collisions test the ball center against colliders grown by selfCollisionBias, so a step
+    // no longer than the thinnest collider can't pass through one
+    uint32_t getRequiredSubsteps(float speed) const
+    {
+        constexpr float minColliderExtent = 0.001f;
+        float thinnest = std::min({ getSize().x, getSize().y, player->getHitBox().getMinExtent(), grid->getMinExtent() });
+        thinnest = std::max(thinnest, minColliderExtent);
+        float distance = speed * std::sqrt(xStep * xStep + yStep * yStep);
+        return std::max(static_cast<uint32_t>(std::ceil(distance / thinnest)), 1u);
+    }
+
+    // Moves 'speed' along the current direction in as many substeps as needed, at most
+    // maxSubsteps, and returns how many were taken
+    uint32_t advance(float speed, GameEvents& events, uint32_t id)
+    {
+        uint32_t substeps = std::min(getRequiredSubsteps(speed), maxSubsteps);
+        for (uint32_t i = 0; i < substeps; i++)
+        {
+            bounce(speed / substeps, events, id);
+        }
+        return substeps;
+    }
+
+    // 'id' tags the events this ball writes
+    void bounce(float speed, GameEvents& events, uint32_t id)
+    {
+        if (getPosition().y < -getYBouncePoint() - 0.1f)
+        {
+            return;
+        }
+
+        float yBouncePoint = 1.499f - (getSize().y / 2.0f);
+        float xBouncePoint = 1.999f - (getSize().x / 2.0f);
+
+        quad.moveX(xStep * speed);
+        quad.moveY(yStep * speed);
+
+        if (quad.getPosition().x > getXBouncePoint())
+        {
+            xStep = -1.0f;
+            events.wallBounce.push(id, getPosition());
+        }
+        if (quad.getPosition().x < -getXBouncePoint())
+        {
+            xStep = 1.0f;
+            events.wallBounce.push(id, getPosition());
+        }
+
+        // Check for player intersection (player position)
+        if (Aabb::fromCenter(getPosition(), Vec2(selfCollisionBias)).overlaps(player->getHitBox()))
+        {
+            yStep = -yStep;
+            quad.moveY(0.05f);
+            events.paddleHit.push(id, getPosition());
+            return;
+        }
+
+        size_t hitIndex = 0;
+        if (grid->findHit(getPosition(), selfCollisionBias, hitIndex))
+        {
+            yStep = -yStep;
+            // The grid changes right away, later balls in the same tick must not hit the brick again
+            Vec2 center = grid->getLayout()[hitIndex].getCenter();
+            if (grid->hitBox(hitIndex) == BoxGrid::HitResult::Destroyed)
+            {
+                events.brickDestroyed.push(static_cast<uint32_t>(hitIndex), center);
+            }
+            else
+            {
+                events.brickHit.push(static_cast<uint32_t>(hitIndex), center);
+            }
+            return;
+        }
+
+        if (quad.getPosition().y > getYBouncePoint())
+        {
+            yStep = -1.0f;
+            events.wallBounce.push(id, getPosition());
+        }
+    }
+
+    inline bool outOfWorld() const
+    {
+        return getPosition().y < -getYBouncePoint();
+    }
+
+    float getYBouncePoint() const
+    {
+        return 1.499f - (getSize().y / 2.0f);
+    }
+
+    float getXBouncePoint() const
+    {
+        return 1.999f - (getSize().x / 2.0f);
+    }
+
+    float getCollisionBias() const
+    {
+        return selfCollisionBias;
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+struct TrajectoryBounce
+{
+    enum class Surface : uint8_t
+    {
+        Wall,
+        Ceiling,
+        Paddle,
+        Brick
+    };
+
+    Surface surface;
+    Vec2 position;
+
+    // Brick index for Surface::Brick
+    uint32_t brick;
+};
+
+struct Trajectory
+{
+    static constexpr size_t maxBounces = 16;
+
+    std::array<TrajectoryBounce, maxBounces> bounces{};
+    size_t bounceCount{ 0 };
+
+    // Where the path first reaches the paddle plane
+    float landingX{ 0.0f };
+    bool landed{ false };
+};
+
+// Playfield limits as Ball::bounce sees them, 'halfExtent' is the ball's collision bias. The
+// ball turns at the paddle as soon as its bias square touches the hit box, which is when its
+// center is 'halfExtent' above the box.
+struct TrajectoryBounds
+{
+    float wall;
+    float ceiling;
+    float paddle;
+    float halfExtent;
+
+    static TrajectoryBounds of(const Ball& ball, const PlayerPlatform& player)
+    {
+        float bias = ball.getCollisionBias();
+        return TrajectoryBounds{ ball.getXBouncePoint(), ball.getYBouncePoint(), player.getHitBox().max.y + bias, bias };
+    }
+};
+
+// Follows the ball through the brick field the way Ball::bounce moves it: walls flip the
+// horizontal direction, the ceiling, the paddle plane and bricks the vertical one, whichever
+// side of the brick was hit. The paddle is assumed to catch the ball. Bricks the predicted
+// hits would destroy are ignored from then on. Stops after 'bounceCount' bounces or, with
+// 'untilLanding', at the paddle plane.
+Trajectory predictTrajectory(const BrickField& field, Vec2 position, Vec2 direction, const TrajectoryBounds& bounds, size_t bounceCount, bool untilLanding = false)
+{
+    Trajectory path;
+    bounceCount = std::min(bounceCount, Trajectory::maxBounces);
+    if (direction.x == 0.0f || direction.y == 0.0f)
+    {
+        return path;
+    }
+
+    // Bricks the path has bounced off so far and how often, one entry per distinct brick
+    std::array<uint32_t, Trajectory::maxBounces> hitBricks;
+    std::array<uint8_t, Trajectory::maxBounces> hitCounts;
+    size_t hitBrickCount = 0;
+
+    const std::vector<uint8_t>& states = *field.states;
+    uint32_t lastBrick = UINT32_MAX;
+    auto accept = [&](size_t idx)
+    {
+        if (idx == lastBrick)
+        {
+            return false;
+        }
+
+        uint8_t state = states[idx];
+        if (BrickState::getMaterial(state) == BrickMaterial::Indestructible)
+        {
+            return true;
+        }
+
+        for (size_t i = 0; i < hitBrickCount; i++)
+        {
+            if (hitBricks[i] == idx)
+            {
+                return hitCounts[i] < BrickState::getHitPoints(state);
+            }
+        }
+        return true;
+    };
+
+    while (path.bounceCount < bounceCount)
+    {
+        float tx = ((direction.x > 0.0f ? bounds.wall : -bounds.wall) - position.x) / direction.x;
+        float ty = ((direction.y > 0.0f ? bounds.ceiling : bounds.paddle) - position.y) / direction.y;
+        tx = std::max(tx, 0.0f);
+        ty = std::max(ty, 0.0f);
+
+        TrajectoryBounce bounce{};
+        RayHit hit;
+        if (raycastBricks(field, position, direction, bounds.halfExtent, std::min(tx, ty), accept, hit))
+        {
+            position += direction * hit.t;
+            direction.y = -direction.y;
+            lastBrick = static_cast<uint32_t>(hit.index);
+            bounce = TrajectoryBounce{ TrajectoryBounce::Surface::Brick, position, lastBrick };
+
+            size_t entry = std::find(hitBricks.begin(), hitBricks.begin() + hitBrickCount, lastBrick) - hitBricks.begin();
+            if (entry == hitBrickCount)
+            {
+                hitBricks[hitBrickCount] = lastBrick;
+                hitCounts[hitBrickCount++] = 0;
+            }
+            hitCounts[entry]++;
+        }
+        else if (tx < ty)
+        {
+            position += direction * tx;
+            direction.x = -direction.x;
+            lastBrick = UINT32_MAX;
+            bounce = TrajectoryBounce{ TrajectoryBounce::Surface::Wall, position, 0 };
+        }
+        else
+        {
+            position += direction * ty;
+            bool falling = direction.y < 0.0f;
+            direction.y = -direction.y;
+            lastBrick = UINT32_MAX;
+            bounce = TrajectoryBounce{ falling ? TrajectoryBounce::Surface::Paddle : TrajectoryBounce::Surface::Ceiling, position, 0 };
+            if (falling && !path.landed)
+            {
+                path.landed = true;
+                path.landingX = position.x;
+            }
+        }
+
+        path.bounces[path.bounceCount++] = bounce;
+        if (untilLanding && path.landed)
+        {
+            break;
+        }
+    }
+    return path;
+}
+
+// -------------------------------------------------------------------------------------------
+// Replaces keyboard input with a paddle that chases the point where the ball will cross the
+// paddle surface, predicted through the brick field with predictTrajectory.
+class BotPlayer
+{
+private:
+    float deadZone = 0.02f;
+
+    // Walls only, for paths with more bounces than a Trajectory holds
+    float predictIgnoringBricks(const Ball& ball, const PlayerPlatform& player) const
+    {
+        const float surfaceY = TrajectoryBounds::of(ball, player).paddle;
+
+        const Vec2 position = ball.getPosition();
+        const Vec2 direction = ball.getDirection();
+        const float top = ball.getYBouncePoint();
+        const float wall = ball.getXBouncePoint();
+
+        // The ball moves diagonally, so horizontal travel equals vertical travel
+        float travel = direction.y > 0.0f
+            ? (top - position.y) + (top - surfaceY)
+            : position.y - surfaceY;
+
+        // Unfold the wall reflections and fold the result back into [-wall, wall]
+        float period = 4.0f * wall;
+        float unfolded = std::fmod(position.x + direction.x * std::max(travel, 0.0f) + wall, period);
+        if (unfolded < 0.0f)
+        {
+            unfolded += period;
+        }
+        if (unfolded > 2.0f * wall)
+        {
+            unfolded = period - unfolded;
+        }
+        return unfolded - wall;
+    }
+
+public:
+    float predictLandingX(const Ball& ball, const PlayerPlatform& player, const BoxGrid& grid) const
+    {
+        Trajectory path = predictTrajectory(grid.getField(), ball.getPosition(), ball.getDirection(),
+            TrajectoryBounds::of(ball, player), Trajectory::maxBounces, true);
+        return path.landed ? path.landingX : predictIgnoringBricks(ball, player);
+    }
+
+    float getDirection(const Ball& ball, const PlayerPlatform& player, const BoxGrid& grid) const
+    {
+        float delta = predictLandingX(ball, player, grid) - player.getPosition().x;
+        if (std::abs(delta) < deadZone)
+        {
+            return 0.0f;
+        }
+        return delta > 0.0f ? 1.0f : -1.0f;
+    }
+};
+#pragma endregion GAME OBJECTS
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- LEVEL EDITOR ------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region LEVEL EDITOR
+// Undo/redo log stored as variable sized records in one byte arena. Each record carries only
+// the bounds and brick state its operation needs and is framed by its op code on both ends,
+// so it can be walked forwards for redo and backwards for undo without a separate index.
+class EditHistory
+{
+public:
+    enum class Op : uint8_t
+    {
+        Place,
+        Remove,
+        Resize,
+    };
+
+    struct Edit
+    {
+        Op op{ Op::Place };
+        uint32_t index{ 0 };
+        Aabb before;
+        Aabb after;
+        // BrickState of the placed or removed brick
+        uint8_t state{ 0 };
+    };
+
+private:
+    std::vector<uint8_t> arena;
+    size_t cursor = 0;
+
+public:
+    EditHistory()
+    {
+        arena.reserve(64 * 1024);
+    }
+
+    void push(const Edit& edit)
+    {
+        // A new edit invalidates everything that could have been redone
+        arena.resize(cursor + recordSize(edit.op));
+        uint8_t* record = arena.data() + cursor;
+
+        *record++ = static_cast<uint8_t>(edit.op);
+        std::memcpy(record, &edit.index, sizeof(edit.index));
+        record += sizeof(edit.index);
+        if (edit.op != Op::Resize)
+        {
+            *record++ = edit.state;
+        }
+        if (edit.op != Op::Place)
+        {
+            std::memcpy(record, &edit.before, sizeof(Aabb));
+            record += sizeof(Aabb);
+        }
+        if (edit.op != Op::Remove)
+        {
+            std::memcpy(record, &edit.after, sizeof(Aabb));
+            record += sizeof(Aabb);
+        }
+        *record = static_cast<uint8_t>(edit.op);
+
+        cursor = arena.size();
+    }
+
+    bool undo(Edit& edit)
+    {
+        if (cursor == 0)
+        {
+            return false;
+        }
+        cursor -= recordSize(static_cast<Op>(arena[cursor - 1]));
+        read(cursor, edit);
+        return true;
+    }
+
+    bool redo(Edit& edit)
+    {
+        if (cursor == arena.size())
+        {
+            return false;
+        }
+        read(cursor, edit);
+        cursor += recordSize(edit.op);
+        return true;
+    }
+
+    void clear()
+    {
+        arena.clear();
+        cursor = 0;
+    }
+
+    size_t getArenaSize() const
+    {
+        return arena.size();
+    }
+
+private:
+    static size_t recordSize(Op op)
+    {
+        size_t payload = op == Op::Resize ? 2 * sizeof(Aabb) : sizeof(Aabb) + sizeof(uint8_t);
+        return 2 * sizeof(uint8_t) + sizeof(uint32_t) + payload;
+    }
+
+    void read(size_t offset, Edit& edit) const
+    {
+        const uint8_t* record = arena.data() + offset;
+
+        edit.op = static_cast<Op>(*record++);
+        std::memcpy(&edit.index, record, sizeof(edit.index));
+        record += sizeof(edit.index);
+        if (edit.op != Op::Resize)
+        {
+            edit.state = *record++;
+        }
+        if (edit.op != Op::Place)
+        {
+            std::memcpy(&edit.before, record, sizeof(Aabb));
+            record += sizeof(Aabb);
+        }
+        if (edit.op != Op::Remove)
+        {
+            std::memcpy(&edit.after, record, sizeof(Aabb));
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------------------
+// Place, remove and resize bricks of a BoxGrid in place. Every edit touches one brick, so it
+// costs one BVH refit and one box sized buffer upload regardless of the level size.
+class LevelEditor
+{
+private:
+    Ref<BoxGrid> grid;
+    EditHistory history;
+    Vec2 brickSize;
+    BrickMaterial material = BrickMaterial::Standard;
+
+    static constexpr float pickBias = 0.001f;
+    static constexpr float minBrickSize = 0.01f;
+
+public:
+    LevelEditor(const Ref<BoxGrid>& grid, Vec2 brickSize)
+        :   grid(grid), brickSize(brickSize)
+    {}
+
+    bool place(Vec2 point)
+    {
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Place;
+        edit.after = Aabb::fromCenter(point, brickSize / 2.0f);
+        edit.state = BrickState::make(material);
+
+        size_t idx = 0;
+        if (!grid->placeBox(edit.after, edit.state, idx))
+        {
+            return false;
+        }
+        edit.index = static_cast<uint32_t>(idx);
+        edit.after = grid->getLayout()[idx];
+        history.push(edit);
+        return true;
+    }
+
+    bool remove(Vec2 point)
+    {
+        size_t idx = 0;
+        if (!grid->findHit(point, pickBias, idx))
+        {
+            return false;
+        }
+
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Remove;
+        edit.index = static_cast<uint32_t>(idx);
+        edit.before = grid->getLayout()[idx];
+        edit.state = grid->getState(idx);
+        grid->destroyBox(idx);
+        history.push(edit);
+        return true;
+    }
+
+    bool resize(Vec2 point, float factor)
+    {
+        size_t idx = 0;
+        if (!grid->findHit(point, pickBias, idx))
+        {
+            return false;
+        }
+
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Resize;
+        edit.index = static_cast<uint32_t>(idx);
+        edit.before = grid->getLayout()[idx];
+
+        Vec2 halfSize = glm::max((edit.before.max - edit.before.min) * factor, Vec2(minBrickSize)) / 2.0f;
+        edit.after = grid->clampBounds(idx, Aabb::fromCenter(edit.before.getCenter(), halfSize));
+        if (edit.after == edit.before)
+        {
+            return false;
+        }
+
+        grid->resizeBox(idx, edit.after);
+        history.push(edit);
+        return true;
+    }
+
+    bool undo()
+    {
+        EditHistory::Edit edit;
+        if (!history.undo(edit))
+        {
+            return false;
+        }
+
+        switch (edit.op)
+        {
+        case EditHistory::Op::Place:
+            grid->destroyBox(edit.index);
+            break;
+        case EditHistory::Op::Remove:
+            grid->reviveBox(edit.index, edit.before, edit.state);
+            break;
+        case EditHistory::Op::Resize:
+            grid->resizeBox(edit.index, edit.before);
+            break;
+        }
+        return true;
+    }
+
+    bool redo()
+    {
+        EditHistory::Edit edit;
+        if (!history.redo(edit))
+        {
+            return false;
+        }
+
+        switch (edit.op)
+        {
+        case EditHistory::Op::Place:
+            grid->reviveBox(edit.index, edit.after, edit.state);
+            break;
+        case EditHistory::Op::Remove:
+            grid->destroyBox(edit.index);
+            break;
+        case EditHistory::Op::Resize:
+            grid->resizeBox(edit.index, edit.after);
+            break;
+        }
+        return true;
+    }
+
+    // Material used for newly placed bricks
+    void cycleMaterial()
+    {
+        material = static_cast<BrickMaterial>((static_cast<uint8_t>(material) + 1) % static_cast<uint8_t>(BrickMaterial::Count));
+    }
+
+    size_t getHistorySize() const
+    {
+        return history.getArenaSize();
+    }
+};
+#pragma endregion LEVEL EDITOR
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- DIAGNOSTICS -------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region DIAGNOSTICS
+size_t getHeapUsage()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)))
+    {
+        return counters.PrivateUsage;
+    }
+    return 0;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+// Opens the device once per refresh rate, starts a short tone a number of times and measures
+// each start with AudioLatencyProbe. A setting is stable when the driver accepted it and the
+// spread between median and p99 stays within a millisecond; the stable one with the lowest
+// p99 is recommended.
+void probeAudioLatency(const char* deviceName, int frequency)
+{
+    constexpr int starts = 64;
+    constexpr float maxSpreadMs = 1.0f;
+
+    int bestRefresh = 0;
+    float bestP99 = INFINITY;
+    for (int refresh : { 25, 50, 100, 200, 400 })
+    {
+        ALCdevice* device = alcOpenDevice(deviceName);
+        if (!device)
+        {
+            throw std::runtime_error("Failed to open audio device: "s + (deviceName ? deviceName : "default"));
+        }
+
+        AudioDeviceSettings requested{ frequency, refresh };
+        auto attributes = requested.getAttributes();
+        ALCcontext* context = alcCreateContext(device, attributes.data());
+        if (!context)
+        {
+            alcCloseDevice(device);
+            std::cout << "[probe] refresh=" << refresh << " rejected" << std::endl;
+            continue;
+        }
+        alcMakeContextCurrent(context);
+        AudioDeviceSettings actual = AudioDeviceSettings::query(device);
+
+        AudioLatencyProbe probe;
+        if (!probe.isAvailable())
+        {
+            alcMakeContextCurrent(nullptr);
+            alcDestroyContext(context);
+            alcCloseDevice(device);
+            std::cout << "[probe] AL_SOFT_source_latency is not supported" << std::endl;
+            return;
+        }
+
+        // 20 ms of a synthesized tone
+        VoiceBank bank(actual.frequency);
+        bank.trigger(makeHitPatch(HitKind::Paddle));
+        std::vector<float> tone(static_cast<size_t>(actual.frequency / 50));
+        bank.render(tone.data(), tone.size());
+        std::vector<short> pcm(tone.size());
+        std::transform(tone.begin(), tone.end(), pcm.begin(), [](float sample) { return static_cast<short>(sample * 32767.0f); });
+
+        ALuint buffer = 0;
+        ALuint source = 0;
+        alGenBuffers(1, &buffer);
+        alBufferData(buffer, AL_FORMAT_MONO16, pcm.data(), static_cast<ALsizei>(pcm.size() * sizeof(short)), actual.frequency);
+        alGenSources(1, &source);
+        alSourcei(source, AL_BUFFER, static_cast<ALint>(buffer));
+
+        for (int i = 0; i < starts; i++)
+        {
+            alSourcePlay(source);
+            probe.measure(source);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            alSourceStop(source);
+        }
+
+        LatencyDistribution latency = probe.takeDistribution();
+        bool stable = actual.refresh == refresh && latency.p99 - latency.p50 <= maxSpreadMs;
+        std::cout << "[probe] refresh=" << refresh << " actual=" << actual.refresh << " frequency=" << actual.frequency
+            << " " << latency << " device=" << probe.getDeviceLatencyMs() << "ms" << (stable ? "" : " unstable") << std::endl;
+        if (stable && latency.p99 < bestP99)
+        {
+            bestP99 = latency.p99;
+            bestRefresh = refresh;
+        }
+
+        alDeleteSources(1, &source);
+        alDeleteBuffers(1, &buffer);
+        alcMakeContextCurrent(nullptr);
+        alcDestroyContext(context);
+        alcCloseDevice(device);
+    }
 
+    if (bestRefresh)
+    {
+        std::cout << "[probe] lowest stable setting: --audio-refresh " << bestRefresh << " (p99 " << bestP99 << "ms)" << std::endl;
+    }
+    else
+    {
+        std::cout << "[probe] no stable setting, keep the driver defaults" << std::endl;
+    }
+}
 
-class Ball : public IRefCounted
+// -------------------------------------------------------------------------------------------
+// Collects frame times for long unattended runs and periodically logs percentiles together
+// with heap usage and live GL object counts. Everything is compared against the first report,
+// so slow leaks and gradual frame time decay show up as a growing delta.
+class SoakMonitor
 {
 private:
-    Quad quad;
-
-    Ref<PlayerPlatform> player;
-    Ref<BoxGrid> grid;
-    Ref<AudioEntry> audioEntry;
-    Ref<AudioSource> audioSource;
+    struct Snapshot
+    {
+        float p50{};
+        float p99{};
+        size_t heap{};
+        size_t glObjects{};
+    };
 
-    float selfCollisionBias = 0.02f;
+    double reportInterval;
+    double elapsed = 0.0;
+    double sinceReport = 0.0;
+    size_t resets = 0;
+
+    std::vector<float> frameTimes;
+    UniformStats uniforms;
+    SoundStats sounds;
+    size_t bricksDestroyed = 0;
+    size_t bounces = 0;
+    size_t ballsLost = 0;
+    size_t substeps = 0;
+    uint32_t maxSubsteps = 0;
+    size_t cappedTicks = 0;
+    Snapshot baseline;
+    bool hasBaseline = false;
 
 public:
-    Ball(Vec2 position, Vec2 size, const Ref<PlayerPlatform>& player, const Ref<BoxGrid>& grid)
-        : quad(position, size, "shaders/ball.vert", "shaders/ball.frag"), player(player), grid(grid), audioEntry(Ref<AudioEntry>::make("audio/click.wav")), audioSource(Ref<AudioSource>::make())
-    {}
+    SoakMonitor(double reportInterval = 60.0)
+        :   reportInterval(reportInterval)
+    {
+        frameTimes.reserve(static_cast<size_t>(reportInterval * 240.0));
+    }
 
-    void draw(const Mat4& projection)
+    void recordFrame(float deltaTime, const UniformStats& frameUniforms = {}, const SoundStats& frameSounds = {})
     {
-        quad.draw(projection);
+        frameTimes.push_back(deltaTime);
+        sounds.requested += frameSounds.requested;
+        sounds.played += frameSounds.played;
+        sounds.batches += frameSounds.batches;
+        uniforms.issued += frameUniforms.issued;
+        uniforms.skipped += frameUniforms.skipped;
+        elapsed += deltaTime;
+        sinceReport += deltaTime;
+
+        if (sinceReport >= reportInterval)
+        {
+            report();
+            sinceReport = 0.0;
+        }
     }
 
-    void move(Vec2 direction, float speed)
+    void recordEvents(const GameEvents& events)
     {
-        quad.moveX(direction.x * speed);
-        quad.moveY(direction.y * speed);
+        bricksDestroyed += events.brickDestroyed.size() + events.bricksDetonated;
+        bounces += events.brickHit.size() + events.brickDestroyed.size() + events.wallBounce.size() + events.paddleHit.size();
+        ballsLost += events.ballLost.size();
     }
 
-    Vec2 getPosition() const
+    // Most substeps any ball needed in a tick and whether the cap cut it short
+    void recordSubsteps(uint32_t tickSubsteps, bool capped)
     {
-        return quad.getPosition();
+        substeps += tickSubsteps;
+        maxSubsteps = std::max(maxSubsteps, tickSubsteps);
+        cappedTicks += capped;
     }
 
-    Vec2 getSize() const
+    void recordReset()
     {
-        return quad.getSize();
+        resets++;
     }
 
-    // Test code before implementing collision detection
-    float xStep = 1.0f;
-    float yStep = +1.0f;
-    void bounce(float speed)
+    double getElapsed() const
     {
-        if (getPosition().y < -getYBouncePoint() - 0.1f)
+        return elapsed;
+    }
+
+private:
+    float percentile(float fraction)
+    {
+        auto nth = frameTimes.begin() + static_cast<ptrdiff_t>(fraction * (frameTimes.size() - 1));
+        std::nth_element(frameTimes.begin(), nth, frameTimes.end());
+        return *nth;
+    }
+
+    void report()
+    {
+        if (frameTimes.empty())
         {
             return;
         }
 
-        float yBouncePoint = 1.499f - (getSize().y / 2.0f);
-        float xBouncePoint = 1.999f - (getSize().x / 2.0f);
+        Snapshot current;
+        current.p50 = percentile(0.50f);
+        float p95 = percentile(0.95f);
+        current.p99 = percentile(0.99f);
+        float worst = *std::max_element(frameTimes.begin(), frameTimes.end());
+        current.heap = getHeapUsage();
+        current.glObjects = Buffer::getLiveCount() + VertexArray::getLiveCount() + Shader::getLiveCount() + TextureArray::getLiveCount();
 
-        quad.moveX(xStep * speed);
-        quad.moveY(yStep * speed);
+        if (!hasBaseline)
+        {
+            baseline = current;
+            hasBaseline = true;
+        }
 
-        if (quad.getPosition().x > getXBouncePoint())
+        std::cout << "[soak] t=" << static_cast<long long>(elapsed) << "s"
+            << " resets=" << resets
+            << " frames=" << frameTimes.size()
+            << " p50=" << current.p50 * 1000.0f << "ms"
+            << " p95=" << p95 * 1000.0f << "ms"
+            << " p99=" << current.p99 * 1000.0f << "ms"
+            << " max=" << worst * 1000.0f << "ms"
+            << " heap=" << current.heap / 1024 << "KiB"
+            << " (" << (static_cast<long long>(current.heap) - static_cast<long long>(baseline.heap)) / 1024 << "KiB)"
+            << " buffers=" << Buffer::getLiveCount()
+            << " vaos=" << VertexArray::getLiveCount()
+            << " programs=" << Shader::getLiveCount()
+            << " textures=" << TextureArray::getLiveCount()
+            << " uniforms/frame=" << static_cast<double>(uniforms.issued) / frameTimes.size() << " issued, "
+            << static_cast<double>(uniforms.skipped) / frameTimes.size() << " skipped"
+            << " sounds=" << sounds.requested << " requested, " << sounds.played << " played in " << sounds.batches << " batches"
+            << " bricks=" << bricksDestroyed << " bounces=" << bounces << " ballsLost=" << ballsLost
+            << " substeps/tick=" << static_cast<double>(substeps) / frameTimes.size() << " max=" << maxSubsteps << " capped=" << cappedTicks
+            << std::endl;
+
+        if (current.glObjects != baseline.glObjects)
         {
-            xStep = -1.0f;
-            audioSource->playSound(audioEntry);
+            std::cout << "[soak] WARNING: live GL objects changed from " << baseline.glObjects << " to " << current.glObjects << std::endl;
         }
-        if (quad.getPosition().x < -getXBouncePoint())
+        if (current.p99 > baseline.p99 * 1.5f)
         {
-            xStep = 1.0f;
-            audioSource->playSound(audioEntry);
+            std::cout << "[soak] WARNING: p99 frame time degraded from " << baseline.p99 * 1000.0f << "ms to " << current.p99 * 1000.0f << "ms" << std::endl;
         }
 
-        // Check for player intersection (player position)
-        constexpr float collisionBias = 0.6f;
+        frameTimes.clear();
+        uniforms = {};
+        sounds = {};
+        bricksDestroyed = 0;
+        bounces = 0;
+        ballsLost = 0;
+        substeps = 0;
+        maxSubsteps = 0;
+        cappedTicks = 0;
+    }
+};
+#pragma endregion DIAGNOSTICS
+
+// -------------------------------------------------------------------------------------------
+// ----------------------------- BENCHMARKS --------------------------------------------------
+// -------------------------------------------------------------------------------------------
+#pragma region BENCHMARKS
+using BenchClock = std::chrono::steady_clock;
+
+double elapsedMs(BenchClock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - since).count();
+}
+
+// Jittered freeform layout with mixed brick sizes covering the upper part of the playfield
+std::vector<Aabb> generateBenchLayout(size_t count, std::mt19937& rng)
+{
+    size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+    Vec2 cell{ 4.0f / side, 1.5f / side };
+    std::uniform_real_distribution<float> scale(0.3f, 0.9f);
+
+    std::vector<Aabb> bricks;
+    bricks.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Vec2 center{ -2.0f + cell.x * (i % side + 0.5f), 1.5f - cell.y * (i / side + 0.5f) };
+        bricks.emplace_back(Aabb::fromCenter(center, Vec2{ cell.x * scale(rng), cell.y * scale(rng) } / 2.0f));
+    }
+    return bricks;
+}
+
+void benchmarkBrickBvh()
+{
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> x(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> y(0.0f, 1.5f);
+    constexpr float ballBias = 0.02f;
 
-        if (getPosition().x - selfCollisionBias < player->getPosition().x + player->getSize().x / 2
-            && getPosition().x + selfCollisionBias > player->getPosition().x - player->getSize().x / 2
-            && getPosition().y - selfCollisionBias< player->getPosition().y + player->getSize().y / 2 - collisionBias
-            && getPosition().y + selfCollisionBias > player->getPosition().y - player->getSize().y / 2 - collisionBias)
+    for (size_t count : { 1'000, 10'000, 100'000, 1'000'000 })
+    {
+        auto layout = generateBenchLayout(count, rng);
+
+        auto start = BenchClock::now();
+        BrickBvh bvh(layout);
+        double buildMs = elapsedMs(start);
+
+        constexpr size_t queries = 100'000;
+        std::vector<Vec2> points(queries);
+        for (auto& point : points)
         {
-            yStep = -yStep;
-            quad.moveY(0.05f);
-            audioSource->playSound(audioEntry);
-            return;
+            point = Vec2{ x(rng), y(rng) };
+        }
+
+        size_t hits = 0;
+        size_t hitIndex = 0;
+        start = BenchClock::now();
+        for (const auto& point : points)
+        {
+            hits += bvh.queryFirst(Aabb::fromCenter(point, Vec2(ballBias)), hitIndex);
         }
+        double bvhNs = elapsedMs(start) * 1e6 / queries;
 
-        const auto& boxes = grid->getBoxes();
-        for (size_t i = 0; i < boxes.size(); i++)
+        // The linear scan is what Ball::bounce used to do, sample fewer queries for large levels
+        size_t linearQueries = std::min<size_t>(queries, 100'000'000 / count);
+        size_t linearHits = 0;
+        start = BenchClock::now();
+        for (size_t q = 0; q < linearQueries; q++)
         {
-            if (boxes[i].hit(getPosition(), getSize(), selfCollisionBias))
+            Aabb box = Aabb::fromCenter(points[q], Vec2(ballBias));
+            for (const auto& brick : layout)
             {
-                yStep = -yStep;
-                grid->destroyBox(i);
-                audioSource->playSound(audioEntry);
-                return;
+                if (brick.overlaps(box))
+                {
+                    linearHits++;
+                    break;
+                }
             }
         }
+        double linearNs = elapsedMs(start) * 1e6 / linearQueries;
 
-        if (quad.getPosition().y > getYBouncePoint())
+        // Remove half of the bricks in random order through the refit path
+        std::vector<size_t> removals(count);
+        for (size_t i = 0; i < count; i++)
         {
-            yStep = -1.0f;
-            audioSource->playSound(audioEntry);
+            removals[i] = i;
+        }
+        std::shuffle(removals.begin(), removals.end(), rng);
+        removals.resize(count / 2);
+
+        start = BenchClock::now();
+        for (size_t brick : removals)
+        {
+            bvh.remove(brick);
         }
+        double removeNs = elapsedMs(start) * 1e6 / removals.size();
+
+        std::cout << "[bench] bvh bricks=" << count
+            << " nodes=" << bvh.getNodeCount()
+            << " build=" << buildMs << "ms"
+            << " query=" << bvhNs << "ns"
+            << " linear=" << linearNs << "ns"
+            << " remove=" << removeNs << "ns"
+            << " hits=" << hits << "/" << linearHits
+            << std::endl;
     }
+}
 
-    inline bool outOfWorld() const
+// Editor edits on a 100k-brick freeform level, each doing what the LevelEditor does to the
+// collision structures and the undo arena. The GPU side is one box sized buffer update per edit.
+void benchmarkLevelEditing()
+{
+    constexpr size_t count = 100'000;
+    constexpr size_t edits = 10'000;
+    constexpr float pickBias = 0.001f;
+
+    std::mt19937 rng(4242);
+    std::vector<Aabb> layout = generateBenchLayout(count, rng);
+    BrickBvh bvh(layout);
+    OccupancyBitmap occupancy(static_cast<int>(count), 1);
+    for (size_t i = 0; i < count; i++)
     {
-        return getPosition().y < -getYBouncePoint();
+        occupancy.set(static_cast<int>(i), 0, true);
     }
+    EditHistory history;
 
-private:
-    float getYBouncePoint() const
+    std::uniform_real_distribution<float> x(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> y(0.0f, 1.5f);
+    const Vec2 brickHalf{ 0.01f, 0.004f };
+
+    // Placing appends a brick, as BoxGrid::placeBox does for freeform layouts
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < edits; i++)
     {
-        return 1.499f - (getSize().y / 2.0f);
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Place;
+        edit.after = Aabb::fromCenter(Vec2{ x(rng), y(rng) }, brickHalf);
+        edit.state = BrickState::make(BrickMaterial::Standard);
+
+        size_t idx = bvh.insert(edit.after);
+        layout.push_back(edit.after);
+        occupancy.growWidth(static_cast<int>(layout.size()));
+        occupancy.set(static_cast<int>(idx), 0, true);
+
+        edit.index = static_cast<uint32_t>(idx);
+        history.push(edit);
     }
+    double placeUs = elapsedMs(start) * 1e3 / edits;
 
-    float getXBouncePoint() const
+    // Resizing picks the brick under the cursor and refits its leaf
+    size_t resized = 0;
+    start = BenchClock::now();
+    for (size_t i = 0; i < edits; i++)
     {
-        return 1.999f - (getSize().x / 2.0f);
+        size_t idx = 0;
+        if (!bvh.queryFirst(Aabb::fromCenter(Vec2{ x(rng), y(rng) }, Vec2(pickBias)), idx))
+        {
+            continue;
+        }
+
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Resize;
+        edit.index = static_cast<uint32_t>(idx);
+        edit.before = layout[idx];
+        edit.after = Aabb::fromCenter(layout[idx].getCenter(), (layout[idx].max - layout[idx].min) * 0.4f);
+        layout[idx] = edit.after;
+        bvh.update(idx, edit.after);
+        history.push(edit);
+        resized++;
+    }
+    double resizeUs = elapsedMs(start) * 1e3 / edits;
+
+    // Removing picks the brick under the cursor and clears it
+    size_t removed = 0;
+    start = BenchClock::now();
+    for (size_t i = 0; i < edits; i++)
+    {
+        size_t idx = 0;
+        if (!bvh.queryFirst(Aabb::fromCenter(Vec2{ x(rng), y(rng) }, Vec2(pickBias)), idx))
+        {
+            continue;
+        }
+
+        EditHistory::Edit edit;
+        edit.op = EditHistory::Op::Remove;
+        edit.index = static_cast<uint32_t>(idx);
+        edit.before = layout[idx];
+        edit.state = BrickState::make(BrickMaterial::Standard);
+        bvh.remove(idx);
+        occupancy.set(static_cast<int>(idx), 0, false);
+        history.push(edit);
+        removed++;
+    }
+    double removeUs = elapsedMs(start) * 1e3 / edits;
+
+    // What a placement cost when it rebuilt the whole occupancy row
+    constexpr size_t rebuilds = 100;
+    start = BenchClock::now();
+    for (size_t i = 0; i < rebuilds; i++)
+    {
+        occupancy.reset(static_cast<int>(layout.size()), 1);
+        for (size_t j = 0; j < layout.size(); j++)
+        {
+            occupancy.set(static_cast<int>(j), 0, true);
+        }
+    }
+    double rebuildUs = elapsedMs(start) * 1e3 / rebuilds;
+
+    std::cout << "[bench] editor bricks=" << count
+        << " place=" << placeUs << "us"
+        << " resize=" << resizeUs << "us (" << resized << ")"
+        << " remove=" << removeUs << "us (" << removed << ")"
+        << " rebuild=" << rebuildUs << "us"
+        << " arena=" << history.getArenaSize() << "B"
+        << std::endl;
+}
+
+void benchmarkTimerWheel()
+{
+    constexpr size_t timerCount = 100'000;
+    constexpr float frameTime = 1.0f / 60.0f;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> delay(0.01, 60.0);
+    TimerWheel wheel(timerCount);
+
+    size_t fired = 0;
+    TimerCallback onFire = [](void* context, uint32_t) { (*static_cast<size_t*>(context))++; };
+
+    std::vector<TimerId> ids(timerCount);
+    auto start = BenchClock::now();
+    for (auto& id : ids)
+    {
+        id = wheel.schedule(delay(rng), onFire, &fired);
+    }
+    double scheduleNs = elapsedMs(start) * 1e6 / timerCount;
+
+    // Cancel a tenth of them, as expiring power-ups being re-collected would
+    start = BenchClock::now();
+    for (size_t i = 0; i < timerCount; i += 10)
+    {
+        wheel.cancel(ids[i]);
+    }
+    double cancelNs = elapsedMs(start) * 1e6 / (timerCount / 10);
+
+    // One minute of 60 Hz frames fires everything left
+    double worstFrameUs = 0.0;
+    start = BenchClock::now();
+    for (int frame = 0; frame < 3700; frame++)
+    {
+        auto frameStart = BenchClock::now();
+        wheel.advance(frameTime);
+        worstFrameUs = std::max(worstFrameUs, elapsedMs(frameStart) * 1e3);
+    }
+    double advanceUs = elapsedMs(start) * 1e3 / 3700;
+
+    std::cout << "[bench] timers=" << timerCount
+        << " schedule=" << scheduleNs << "ns"
+        << " cancel=" << cancelNs << "ns"
+        << " advance=" << advanceUs << "us/frame"
+        << " worst=" << worstFrameUs << "us"
+        << " fired=" << fired
+        << std::endl;
+}
+
+ScriptTask benchScript(ScriptRunner& runner, size_t& resumes, uint32_t seed)
+{
+    for (;;)
+    {
+        co_await runner.waitTicks(1 + seed % 3);
+        resumes++;
+        co_await runner.waitEvent(ScriptEvent::BrickDestroyed);
+        resumes++;
+        co_await runner.waitSeconds(0.01 * (1 + seed % 5));
+        resumes++;
+    }
+}
+
+void benchmarkScripts()
+{
+    constexpr uint32_t scriptCount = 5'000;
+    constexpr int tickCount = 1'000;
+
+    ScriptRunner runner(scriptCount);
+    size_t resumes = 0;
+    for (uint32_t i = 0; i < scriptCount; i++)
+    {
+        runner.start(benchScript(runner, resumes, i));
+    }
+    size_t poolCapacity = FramePool::get().getCapacity();
+
+    auto start = BenchClock::now();
+    for (int tick = 0; tick < tickCount; tick++)
+    {
+        if (tick % 2 == 0)
+        {
+            runner.signal(ScriptEvent::BrickDestroyed);
+        }
+        runner.update(1.0f / 60.0f);
+    }
+    double totalMs = elapsedMs(start);
+
+    std::cout << "[bench] scripts=" << scriptCount
+        << " resumes=" << resumes
+        << " perResume=" << totalMs * 1e6 / std::max<size_t>(resumes, 1) << "ns"
+        << " perTick=" << totalMs * 1e3 / tickCount << "us"
+        << " frames=" << FramePool::get().getLiveBlocks()
+        << " poolGrowth=" << FramePool::get().getCapacity() - poolCapacity
+        << " oversized=" << FramePool::get().getOversizedFrames()
+        << std::endl;
+
+    runner.clear();
+}
+
+void benchmarkOccupancy()
+{
+    constexpr int width = 4096;
+    constexpr int height = 256;
+    constexpr size_t queries = 1'000'000;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> column(0, width - 1);
+    std::uniform_int_distribution<int> row(0, height - 1);
+    std::uniform_int_distribution<int> extent(1, 64);
+
+    // Sparse, so most region queries have to look at every word they cover
+    OccupancyBitmap occupancy(width, height);
+    for (int i = 0; i < width * height / 1000; i++)
+    {
+        occupancy.set(column(rng), row(rng), true);
+    }
+
+    struct Rect
+    {
+        int x0, y0, x1, y1;
+    };
+    std::vector<Rect> rects(queries);
+    for (auto& rect : rects)
+    {
+        rect.x0 = column(rng);
+        rect.y0 = row(rng);
+        rect.x1 = rect.x0 + extent(rng) * 16;
+        rect.y1 = rect.y0 + extent(rng) / 16 + 1;
+    }
+
+    size_t found = 0;
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < queries; i++)
+    {
+        found += occupancy.anyInRow(static_cast<int>(i % height));
+    }
+    double rowNs = elapsedMs(start) * 1e6 / queries;
+
+    start = BenchClock::now();
+    for (size_t i = 0; i < queries; i++)
+    {
+        int x = 0;
+        int y = 0;
+        found += occupancy.findLastRow(y) && occupancy.findFirstInRow(y, x);
+    }
+    double lowestNs = elapsedMs(start) * 1e6 / queries;
+
+    start = BenchClock::now();
+    for (const auto& rect : rects)
+    {
+        found += occupancy.anyInRect(rect.x0, rect.y0, rect.x1, rect.y1);
+    }
+    double rectNs = elapsedMs(start) * 1e6 / queries;
+
+    size_t counted = 0;
+    start = BenchClock::now();
+    for (const auto& rect : rects)
+    {
+        counted += occupancy.countInRect(rect.x0, rect.y0, rect.x1, rect.y1);
+    }
+    double countNs = elapsedMs(start) * 1e6 / queries;
+
+    std::cout << "[bench] occupancy grid=" << width << "x" << height
+        << " row=" << rowNs << "ns"
+        << " lowest=" << lowestNs << "ns"
+        << " anyInRect=" << rectNs << "ns"
+        << " countInRect=" << countNs << "ns"
+        << " found=" << found << " counted=" << counted
+        << std::endl;
+}
+
+// One ball hit setting off a 1000x1000 level of explosive bricks with a scattering of
+// indestructible ones, timed through the same steps as a game tick: BoxGrid's chain reaction,
+// the BVH batch removal, staging the changed state range and counting the bricks as events.
+// The BVH refit that removal defers is then timed slice by slice over the following ticks.
+// Not covered without a GL context: the glNamedBufferSubData of the range, which the driver
+// takes as a copy like the one staged here, and power-up spawning, which the tick stops once
+// PowerUpSystem::capacity power-ups are falling.
+void benchmarkChainReaction()
+{
+    constexpr int side = 1000;
+    constexpr size_t count = static_cast<size_t>(side) * side;
+    constexpr size_t indestructibleEvery = 97;
+
+    std::vector<Aabb> layout = BoxGrid::generateLayout(Vec2{ 0.0f, 0.0f }, Vec2(0.9f), 0.1f, side, side);
+    std::vector<uint8_t> states(count, BrickState::make(BrickMaterial::Explosive));
+    OccupancyBitmap occupancy(side, side);
+    for (size_t i = 0; i < count; i++)
+    {
+        occupancy.set(static_cast<int>(i % side), static_cast<int>(i / side), true);
+        if (i % indestructibleEvery == 0)
+        {
+            states[i] = BrickState::make(BrickMaterial::Indestructible);
+        }
+    }
+    BrickBvh bvh(layout);
+
+    BlastQueue queue;
+    GameEvents events;
+    std::vector<uint32_t> destroyed;
+    std::vector<uint8_t> staging(count);
+
+    // The ball destroyed the brick in the middle, as BoxGrid::hitBox leaves it
+    uint32_t source = static_cast<uint32_t>(side / 2) * side + side / 2;
+    states[source] = BrickState::make(BrickMaterial::Explosive, 0);
+    occupancy.set(static_cast<int>(source % side), static_cast<int>(source / side), false);
+    bvh.remove(source);
+    events.brickDestroyed.push(source, layout[source].getCenter());
+
+    auto start = BenchClock::now();
+    auto [first, last] = BoxGrid::resolveChainReaction(events.brickDestroyed.subject, side, states, occupancy, queue, destroyed);
+    double resolveMs = elapsedMs(start);
+
+    auto phase = BenchClock::now();
+    bvh.removeBatch(destroyed);
+    double bvhMs = elapsedMs(phase);
+
+    phase = BenchClock::now();
+    std::copy(states.begin() + first, states.begin() + last, staging.begin());
+    double uploadMs = elapsedMs(phase);
+
+    phase = BenchClock::now();
+    events.bricksDetonated = destroyed.size();
+    double eventsMs = elapsedMs(phase);
+    double tickMs = elapsedMs(start);
+
+    size_t refitTicks = 0;
+    double refitMs = 0.0;
+    for (bool pending = true; pending; refitTicks++)
+    {
+        phase = BenchClock::now();
+        pending = bvh.refitSome(BoxGrid::bvhRefitSlice);
+        refitMs = std::max(refitMs, elapsedMs(phase));
+    }
+
+    size_t survivors = occupancy.countInRect(0, 0, side, side);
+    std::cout << "[bench] chain reaction grid=" << side << "x" << side
+        << " tick=" << tickMs << "ms"
+        << " resolve=" << resolveMs << "ms"
+        << " bvh=" << bvhMs << "ms"
+        << " upload=" << uploadMs << "ms (" << last - first << " bytes)"
+        << " events=" << eventsMs << "ms"
+        << " refit=" << refitTicks << "x" << refitMs << "ms"
+        << " destroyed=" << destroyed.size()
+        << " survivors=" << survivors
+        << " spread=" << queue.getSpreadCount()
+        << std::endl;
+}
+
+// Ten bounce predictions on the default level layout, with a quarter of the bricks knocked out,
+// walked as a uniform grid and again as a freeform layout through the BVH
+void benchmarkTrajectory()
+{
+    constexpr int gridX = 10;
+    constexpr int gridY = 7;
+    constexpr float margin = 0.01f;
+    constexpr float xSize = 4.0f / gridX - margin * 1.1f;
+    constexpr float ySize = xSize / 3;
+    constexpr size_t predictions = 100'000;
+    const Vec2 position{ -2.0f + margin + xSize / 2, 1.5f - margin - ySize / 2 };
+
+    std::mt19937 rng(99);
+    std::vector<Aabb> layout = BoxGrid::generateLayout(position, Vec2(xSize, ySize), margin, gridX, gridY);
+    std::vector<uint8_t> states(layout.size(), BrickState::make(BrickMaterial::Standard));
+    OccupancyBitmap occupancy(gridX, gridY);
+    BrickBvh bvh(layout);
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        bool alive = rng() % 4 != 0;
+        states[i] = alive ? states[i] : 0;
+        occupancy.set(static_cast<int>(i % gridX), static_cast<int>(i / gridX), alive);
+        if (!alive)
+        {
+            bvh.remove(i);
+        }
+    }
+
+    BrickField field{ true, position, Vec2(xSize + margin, ySize + margin), gridX, gridY, &layout, &states, &occupancy, &bvh };
+    BrickField freeform = field;
+    freeform.uniform = false;
+    TrajectoryBounds bounds{ 1.949f, 1.449f, -0.575f, 0.02f };
+
+    std::uniform_real_distribution<float> x(-1.9f, 1.9f);
+    std::uniform_real_distribution<float> y(-0.5f, 0.2f);
+    std::vector<std::pair<Vec2, Vec2>> starts(predictions);
+    for (auto& start : starts)
+    {
+        start = { Vec2{ x(rng), y(rng) }, Vec2{ rng() % 2 ? 1.0f : -1.0f, 1.0f } };
+    }
+
+    size_t bounces = 0;
+    size_t brickBounces = 0;
+    float landing = 0.0f;
+    auto start = BenchClock::now();
+    for (const auto& [origin, direction] : starts)
+    {
+        Trajectory path = predictTrajectory(field, origin, direction, bounds, 10);
+        bounces += path.bounceCount;
+        landing += path.landingX;
+        for (size_t i = 0; i < path.bounceCount; i++)
+        {
+            brickBounces += path.bounces[i].surface == TrajectoryBounce::Surface::Brick;
+        }
+    }
+    double predictionNs = elapsedMs(start) * 1e6 / predictions;
+
+    // Both walks find the same bricks, the landings only differ by rounding
+    float freeformLanding = 0.0f;
+    start = BenchClock::now();
+    for (const auto& [origin, direction] : starts)
+    {
+        freeformLanding += predictTrajectory(freeform, origin, direction, bounds, 10).landingX;
+    }
+    double freeformNs = elapsedMs(start) * 1e6 / predictions;
+
+    std::cout << "[bench] trajectory grid=" << gridX << "x" << gridY
+        << " predict10=" << predictionNs << "ns"
+        << " freeform=" << freeformNs << "ns (landing " << freeformLanding / predictions << ")"
+        << " bounces=" << static_cast<double>(bounces) / predictions
+        << " bricks=" << static_cast<double>(brickBounces) / predictions
+        << " landing=" << landing / predictions
+        << std::endl;
+}
+
+// How many synthesizer voices one core can render in real time
+void benchmarkSynthesizer()
+{
+    constexpr int sampleRate = 48000;
+    constexpr size_t seconds = 4;
+    constexpr size_t chunkFrames = 512;
+    std::vector<float> out(chunkFrames);
+
+    for (size_t voiceCount : { 1, 8, 32 })
+    {
+        VoiceBank bank(sampleRate);
+        for (size_t i = 0; i < voiceCount; i++)
+        {
+            SynthPatch patch;
+            patch.waveform = static_cast<Waveform>(i % 4);
+            patch.frequency = 220.0f + 30.0f * i;
+            patch.noise = 0.2f;
+            patch.hold = static_cast<float>(seconds) * 2.0f;
+            bank.trigger(patch);
+        }
+
+        float checksum = 0.0f;
+        auto start = BenchClock::now();
+        for (size_t frame = 0; frame < sampleRate * seconds; frame += chunkFrames)
+        {
+            bank.render(out.data(), chunkFrames);
+            checksum += out[0];
+        }
+        double ms = elapsedMs(start);
+
+        double voiceLoad = ms / (seconds * 1000.0) / voiceCount;
+        std::cout << "[bench] synth voices=" << voiceCount
+            << " active=" << bank.getActiveCount()
+            << " render=" << ms * 1e6 / (sampleRate * seconds) << "ns/frame"
+            << " load=" << voiceLoad * 100.0 << "%/voice"
+            << " voicesPerCore=" << static_cast<size_t>(1.0 / voiceLoad)
+            << " checksum=" << checksum
+            << std::endl;
+    }
+}
+
+void runBenchmarks()
+{
+    benchmarkBrickBvh();
+    benchmarkLevelEditing();
+    benchmarkTimerWheel();
+    benchmarkScripts();
+    benchmarkSynthesizer();
+    benchmarkOccupancy();
+    benchmarkChainReaction();
+    benchmarkTrajectory();
+}
+#pragma endregion BENCHMARKS
+
+
+// -------------------------------------------------------------------------------------------
+struct LaunchOptions
+{
+    // Drive the paddle with BotPlayer instead of the keyboard
+    bool botPlayer = false;
+
+    // Play, reset and repeat unattended while SoakMonitor logs statistics
+    bool soak = false;
+    double soakHours = 0.0;
+    double soakReportInterval = 60.0;
+
+    // Run the CPU benchmarks and exit without opening a window
+    bool benchmark = false;
+
+    // Ignore GL_KHR_parallel_shader_compile, used to compare startup compile times
+    bool syncShaders = false;
+
+    // Read shaders from res/shaders instead of the embedded copies, F5 reloads them
+    bool shadersFromDisk = false;
+
+    // Resolve every GL function glad knows instead of the ones the game calls
+    bool fullGlLoader = false;
+
+    // Play click.wav for every collision instead of synthesized hit sounds
+    bool sampledHits = false;
+
+    // Requested output rate and mixing updates per second, 0 keeps the driver defaults
+    AudioDeviceSettings audio;
+
+    // Measure latency for a range of refresh rates on the named device and exit. "No Output"
+    // is OpenAL Soft's null device, which works headless.
+    bool audioProbe = false;
+    std::string audioProbeDevice;
+
+    static LaunchOptions parse(int argc, char** argv)
+    {
+        LaunchOptions options;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string_view arg = argv[i];
+            if (arg == "--bot")
+            {
+                options.botPlayer = true;
+            }
+            else if (arg == "--soak")
+            {
+                options.soak = true;
+                options.botPlayer = true;
+            }
+            else if (arg == "--soak-hours" && i + 1 < argc)
+            {
+                options.soak = true;
+                options.botPlayer = true;
+                options.soakHours = std::atof(argv[++i]);
+            }
+            else if (arg == "--soak-report" && i + 1 < argc)
+            {
+                options.soakReportInterval = std::atof(argv[++i]);
+            }
+            else if (arg == "--bench")
+            {
+                options.benchmark = true;
+            }
+            else if (arg == "--sync-shaders")
+            {
+                options.syncShaders = true;
+            }
+            else if (arg == "--shaders-from-disk")
+            {
+                options.shadersFromDisk = true;
+            }
+            else if (arg == "--full-gl-loader")
+            {
+                options.fullGlLoader = true;
+            }
+            else if (arg == "--sampled-hits")
+            {
+                options.sampledHits = true;
+            }
+            else if (arg == "--audio-frequency" && i + 1 < argc)
+            {
+                options.audio.frequency = std::atoi(argv[++i]);
+            }
+            else if (arg == "--audio-refresh" && i + 1 < argc)
+            {
+                options.audio.refresh = std::atoi(argv[++i]);
+            }
+            else if (arg == "--audio-probe")
+            {
+                options.audioProbe = true;
+                if (i + 1 < argc && argv[i + 1][0] != '-')
+                {
+                    options.audioProbeDevice = argv[++i];
+                }
+            }
+        }
+        return options;
     }
 };
-#pragma endregion GAME OBJECTS
-
 
 // -------------------------------------------------------------------------------------------
 class Application
@@ -1063,24 +7491,112 @@ private:
     ALCdevice* audioDevice{ nullptr };
     ALCcontext* audioContext{ nullptr };
 
+    // Extra balls for the multi-ball power-up are created with the level and parked until needed
+    static constexpr size_t maxBalls = 3;
+    static constexpr float paddleWidth = 0.4f;
+    static constexpr float widenedPaddleWidth = 0.6f;
+    static constexpr float widenDuration = 10.0f;
+    static constexpr uint64_t scorePerHit = 1;
+    static constexpr uint64_t scorePerBrick = 10;
+
     Ref<PlayerPlatform> player;
-    Ref<Ball> ball;
+    std::array<Ref<Ball>, maxBalls> balls;
     Ref<BoxGrid> grid;
+    Ref<PowerUpSystem> powerUps;
+    PowerUpSystem::Collected collectedPowerUps{};
+
+    TimerWheel timers;
+    TimerId widenTimer;
+
+    ScriptRunner scripts;
+    float ballSpeed = 1.5f;
+
+    // Streamed in behind the loading screen, game objects share them across level resets
+    struct GameAssets
+    {
+        AssetHandle<Shader> boxShader;
+        AssetHandle<Shader> spriteShader;
+        AssetHandle<Shader> powerUpShader;
+        AssetHandle<AudioEntry> click;
+        AssetHandle<AudioEntry> gameOver;
+    };
+
+    static constexpr double loadBudget = 0.002;
+    static constexpr float loadingBarWidth = 3.6f;
+
+    Scoped<AssetLoader> loader;
+    Scoped<GpuUploader> uploader;
+    GameAssets assets;
+    bool loading = false;
+    bool shadersReported = false;
+    std::chrono::steady_clock::time_point loadStart;
+
+    // Built synchronously, it draws the loading screen
+    Ref<Shader> basicShader;
+    Ref<Quad> loadingBar;
+
+    // Bound to texture unit 0 once uploaded and never rebound
+    SpriteAtlas atlas;
 
-    Ref<AudioEntry> gameOverEntry;
-    Ref<AudioSource> narrator;
+    // Every sound goes through the queue, it is flushed once per frame
+    Ref<SoundQueue> sounds;
+    SoundId clickSound{ 0 };
+    SoundId gameOverSound{ 0 };
     
     bool gameOver = false;
 
+    // Written by the physics step, consumed and cleared in the same update
+    GameEvents events;
+    std::vector<uint32_t> detonated;
+    uint64_t score = 0;
+
+    LaunchOptions options;
+    BotPlayer bot;
+    Scoped<SoakMonitor> soakMonitor;
+
+    Scoped<LevelEditor> editor;
+    bool editing = false;
+
+    std::array<bool, GLFW_KEY_LAST + 1> keyStates{};
+    std::array<bool, GLFW_MOUSE_BUTTON_LAST + 1> mouseStates{};
 
     Mat4 orthoMatrix;
 public:
-    Application(int width, int height, std::string_view title)
+    Application(int width, int height, std::string_view title, const LaunchOptions& options = {})
+        :   options(options)
     {
+        if (options.soak)
+        {
+            soakMonitor = std::make_unique<SoakMonitor>(options.soakReportInterval);
+        }
+
+        // Device probing can take tens of milliseconds, it runs while the window and GL come up
+        // and the asset workers already decode
+        auto start = std::chrono::steady_clock::now();
+        double audioMs = 0.0;
+        auto audioInit = std::async(std::launch::async, [this, &audioMs]()
+        {
+            auto audioStart = std::chrono::steady_clock::now();
+            initAudio();
+            audioMs = elapsedMs(audioStart);
+        });
+
+        // The asset workers preprocess shaders right away, they have to see the source choice
+        ShaderPreprocessor::get().setReadFromDisk(options.shadersFromDisk);
+        requestAssets();
+
         initWindow(width, height, title);
         initContext();
-        initAudio();
-        createResources();
+        double windowMs = elapsedMs(start);
+
+        // AL buffers are created when the loader finalizes, the device has to be up by then
+        audioInit.get();
+        double totalMs = elapsedMs(start);
+        std::cout << "Startup: window and GL " << windowMs << " ms, audio " << audioMs << " ms, saved "
+            << std::max(windowMs + audioMs - totalMs, 0.0) << " ms by initializing in parallel" << std::endl;
+
+        initUploader();
+        beginLoading();
     }
 
     int run()
@@ -1090,12 +7606,48 @@ public:
         {
             auto now = glfwGetTime();
             glfwPollEvents();
+            if (uploader)
+            {
+                uploader->pump();
+            }
             glClear(GL_COLOR_BUFFER_BIT);
+            if (loading)
+            {
+                updateLoading();
+                glfwSwapBuffers(window);
+                Shader::takeUniformStats();
+                continue;
+            }
             render();
             glfwSwapBuffers(window);
-            update(static_cast<float>(glfwGetTime() - now));
+            UniformStats uniforms = Shader::takeUniformStats();
+
+            float deltaTime = static_cast<float>(glfwGetTime() - now);
+            update(deltaTime);
+            sounds->flush(glfwGetTime());
+            SoundStats soundStats = sounds->takeStats();
+
+            if (soakMonitor)
+            {
+                soakMonitor->recordFrame(deltaTime, uniforms, soundStats);
+                if (options.soakHours > 0.0 && soakMonitor->getElapsed() >= options.soakHours * 3600.0)
+                {
+                    glfwSetWindowShouldClose(window, 1);
+                }
+            }
+        }
+
+        if (sounds.get())
+        {
+            AudioLatencyProbe& latency = sounds->getLatency();
+            if (latency.isAvailable())
+            {
+                std::cout << "Audio latency: " << latency.takeDistribution() << ", device " << latency.getDeviceLatencyMs() << "ms" << std::endl;
+            }
         }
 
+        ShaderCache::get().clear();
+        uploader.reset();
         glfwTerminate();
         return 0;
     }
@@ -1113,26 +7665,330 @@ private:
             createResources();
         }
 
-        player->move(deltaTime * -glfwGetKey(window, GLFW_KEY_A), 1.5f);
-        player->move(deltaTime * glfwGetKey(window, GLFW_KEY_D), 1.5f);
-        ball->bounce(deltaTime * 1.5f);
+        if (options.shadersFromDisk && keyPressed(GLFW_KEY_F5))
+        {
+            reloadShaders();
+            return;
+        }
+
+        if (keyPressed(GLFW_KEY_E))
+        {
+            editing = !editing;
+        }
+
+        if (editing)
+        {
+            updateEditor();
+            return;
+        }
+
+        if (options.botPlayer)
+        {
+            player->move(deltaTime * bot.getDirection(trackedBall(), *player, *grid), 1.5f);
+        }
+        else
+        {
+            player->move(deltaTime * -glfwGetKey(window, GLFW_KEY_A), 1.5f);
+            player->move(deltaTime * glfwGetKey(window, GLFW_KEY_D), 1.5f);
+        }
+
+        timers.advance(deltaTime);
+
+        events.clear();
+        float step = deltaTime * ballSpeed;
+        uint32_t substeps = 0;
+        bool capped = false;
+        for (size_t i = 0; i < balls.size(); i++)
+        {
+            if (balls[i]->isActive())
+            {
+                capped |= balls[i]->getRequiredSubsteps(step) > Ball::maxSubsteps;
+                substeps = std::max(substeps, balls[i]->advance(step, events, static_cast<uint32_t>(i)));
+            }
+        }
+        if (soakMonitor)
+        {
+            soakMonitor->recordSubsteps(substeps, capped);
+        }
+
+        // Explosive bricks go off after every ball moved, one chain reaction for the whole tick
+        events.bricksDetonated = grid->detonate(events.brickDestroyed.subject, detonated);
+
+        // A chain reaction can destroy the whole level, stop rolling once no power-up fits
+        for (size_t i = 0; i < events.brickDestroyed.size() && !powerUps->isFull(); i++)
+        {
+            powerUps->trySpawn(events.brickDestroyed.position[i]);
+        }
+        for (size_t i = 0; i < events.bricksDetonated && !powerUps->isFull(); i++)
+        {
+            powerUps->trySpawn(grid->getLayout()[detonated[i]].getCenter());
+        }
+        if (events.brickDestroyed.size() > 0 || events.bricksDetonated > 0)
+        {
+            scripts.signal(ScriptEvent::BrickDestroyed);
+        }
+        score += scorePerHit * events.brickHit.size() + scorePerBrick * (events.brickDestroyed.size() + events.bricksDetonated);
+
+        updatePowerUps(deltaTime);
+
+        if (soakMonitor && (gameOver || grid->getAliveCount() == 0))
+        {
+            soakMonitor->recordReset();
+            createResources();
+            return;
+        }
+
+        // Extra balls leaving the field are retired, losing the last one ends the game
+        size_t ballsInPlay = 0;
+        for (const auto& ball : balls)
+        {
+            ballsInPlay += ball->isActive() && !ball->outOfWorld();
+        }
+
+        for (size_t i = 0; i < balls.size(); i++)
+        {
+            if (balls[i]->isActive() && balls[i]->outOfWorld() && ballsInPlay > 0)
+            {
+                balls[i]->setActive(false);
+                events.ballLost.push(static_cast<uint32_t>(i), balls[i]->getPosition());
+            }
+        }
 
-        if (ball->outOfWorld())
+        if (ballsInPlay == 0)
         {
-            static bool played = false;
             if (!gameOver)
             {
-                narrator->playSound(gameOverEntry);
+                sounds->request(gameOverSound);
                 gameOver = true;
+                // The last balls stay active for the game over screen, report the ones that left
+                for (size_t i = 0; i < balls.size(); i++)
+                {
+                    if (balls[i]->isActive() && balls[i]->outOfWorld())
+                    {
+                        events.ballLost.push(static_cast<uint32_t>(i), balls[i]->getPosition());
+                    }
+                }
+                std::cout << "Game over, score " << score << std::endl;
+            }
+        }
+
+        for (size_t i = 0; i < events.ballLost.size(); i++)
+        {
+            scripts.signal(ScriptEvent::BallLost);
+        }
+        playEventSounds();
+        if (soakMonitor)
+        {
+            soakMonitor->recordEvents(events);
+        }
+
+        scripts.update(deltaTime);
+    }
+
+    void playEventSounds()
+    {
+        if (!sounds->hasSynthesizer())
+        {
+            size_t hits = events.brickHit.size() + events.brickDestroyed.size() + events.wallBounce.size() + events.paddleHit.size() + (events.bricksDetonated > 0);
+            for (size_t i = 0; i < hits; i++)
+            {
+                sounds->request(clickSound);
+            }
+            return;
+        }
+
+        for (const EventStream* bricks : { &events.brickHit, &events.brickDestroyed })
+        {
+            for (Vec2 position : bricks->position)
+            {
+                sounds->requestTone(makeHitPatch(HitKind::Brick, position.y));
+            }
+        }
+        for (size_t i = 0; i < events.wallBounce.size(); i++)
+        {
+            sounds->requestTone(makeHitPatch(HitKind::Wall));
+        }
+        for (size_t i = 0; i < events.paddleHit.size(); i++)
+        {
+            sounds->requestTone(makeHitPatch(HitKind::Paddle));
+        }
+        // A whole chain reaction is a single rumble rather than a tone per brick
+        if (events.bricksDetonated > 0)
+        {
+            sounds->requestTone(makeHitPatch(HitKind::Explosion));
+        }
+    }
+
+    // Scripted events of the default level, resumed from update()
+    ScriptTask runLevelScript()
+    {
+        co_await scripts.waitSeconds(5.0);
+        grid->respawnRow(grid->getRowCount() - 1, BrickMaterial::Standard);
+
+        const size_t startCount = grid->getAliveCount();
+        while (grid->getAliveCount() * 2 > startCount)
+        {
+            co_await scripts.waitEvent(ScriptEvent::BrickDestroyed);
+        }
+        ballSpeed *= 1.25f;
+    }
+
+    void updatePowerUps(float deltaTime)
+    {
+        size_t collected = powerUps->update(deltaTime, player->getHitBox(), collectedPowerUps);
+        if (collected > 0)
+        {
+            scripts.signal(ScriptEvent::PowerUpCollected);
+        }
+
+        for (size_t i = 0; i < collected; i++)
+        {
+            switch (collectedPowerUps[i])
+            {
+            case PowerUpType::Widen:
+                // Catching another one restarts the countdown
+                player->setWidth(widenedPaddleWidth);
+                timers.cancel(widenTimer);
+                widenTimer = timers.schedule(widenDuration, &Application::onWidenExpired, this);
+                break;
+            case PowerUpType::MultiBall:
+                splitBalls();
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    static void onWidenExpired(void* context, uint32_t)
+    {
+        static_cast<Application*>(context)->player->setWidth(paddleWidth);
+    }
+
+    // Launches every parked ball from the first ball in play, fanned out in other directions
+    void splitBalls()
+    {
+        const Ball* source = nullptr;
+        for (auto& ball : balls)
+        {
+            if (ball->isActive() && !ball->outOfWorld())
+            {
+                source = ball.get();
+                break;
+            }
+        }
+        if (!source)
+        {
+            return;
+        }
+
+        Vec2 position = source->getPosition();
+        Vec2 direction = source->getDirection();
+        for (auto& ball : balls)
+        {
+            if (!ball->isActive())
+            {
+                direction.x = -direction.x;
+                ball->launch(position, Vec2{ direction.x, 1.0f });
+            }
+        }
+    }
+
+    // The ball the bot should care about: the lowest one falling towards the paddle
+    const Ball& trackedBall()
+    {
+        const Ball* tracked = nullptr;
+        for (auto& ball : balls)
+        {
+            if (!ball->isActive())
+            {
+                continue;
+            }
+
+            bool falling = ball->getDirection().y < 0.0f;
+            if (!tracked
+                || (falling && tracked->getDirection().y >= 0.0f)
+                || (falling == (tracked->getDirection().y < 0.0f) && ball->getPosition().y < tracked->getPosition().y))
+            {
+                tracked = ball.get();
             }
         }
+        return tracked ? *tracked : *balls[0];
+    }
+
+    void updateEditor()
+    {
+        int width = 0;
+        int height = 0;
+        double cursorX = 0.0;
+        double cursorY = 0.0;
+        glfwGetWindowSize(window, &width, &height);
+        glfwGetCursorPos(window, &cursorX, &cursorY);
+
+        // Window pixels to the orthographic playfield
+        Vec2 cursor{
+            static_cast<float>(cursorX / width) * 4.0f - 2.0f,
+            1.5f - static_cast<float>(cursorY / height) * 3.0f
+        };
+
+        if (mousePressed(GLFW_MOUSE_BUTTON_LEFT))
+        {
+            editor->place(cursor);
+        }
+        if (mousePressed(GLFW_MOUSE_BUTTON_RIGHT))
+        {
+            editor->remove(cursor);
+        }
+        if (keyPressed(GLFW_KEY_RIGHT_BRACKET))
+        {
+            editor->resize(cursor, 1.1f);
+        }
+        if (keyPressed(GLFW_KEY_LEFT_BRACKET))
+        {
+            editor->resize(cursor, 0.9f);
+        }
+        if (keyPressed(GLFW_KEY_Z))
+        {
+            editor->undo();
+        }
+        if (keyPressed(GLFW_KEY_Y))
+        {
+            editor->redo();
+        }
+        if (keyPressed(GLFW_KEY_M))
+        {
+            editor->cycleMaterial();
+        }
+    }
+
+    bool keyPressed(int key)
+    {
+        bool down = glfwGetKey(window, key) == GLFW_PRESS;
+        bool pressed = down && !keyStates[key];
+        keyStates[key] = down;
+        return pressed;
+    }
+
+    bool mousePressed(int button)
+    {
+        bool down = glfwGetMouseButton(window, button) == GLFW_PRESS;
+        bool pressed = down && !mouseStates[button];
+        mouseStates[button] = down;
+        return pressed;
     }
 
     void render()
     {
         player->draw(orthoMatrix);
-        ball->draw(orthoMatrix);
+        for (auto& ball : balls)
+        {
+            if (ball->isActive())
+            {
+                ball->draw(orthoMatrix);
+            }
+        }
         grid->draw(orthoMatrix);
+        powerUps->draw(orthoMatrix);
     }
 
 private:
@@ -1159,9 +8015,19 @@ private:
 
     void initContext()
     {
-        if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+        auto start = std::chrono::steady_clock::now();
+        if (options.fullGlLoader)
+        {
+            if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+            {
+                throw std::runtime_error("Failed to initialize GLAD");
+            }
+            std::cout << "GL loader: every glad entry point in " << elapsedMs(start) << " ms" << std::endl;
+        }
+        else
         {
-            throw std::runtime_error("Failed to initialize GLAD");
+            size_t count = GlLoader::loadUsed();
+            std::cout << "GL loader: " << count << " used entry points in " << elapsedMs(start) << " ms" << std::endl;
         }
 
 #ifndef NDEBUG
@@ -1170,6 +8036,11 @@ private:
 
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        const GlCapabilities& capabilities = GlLoader::detectCapabilities(!options.syncShaders);
+        std::cout << "GL capabilities: parallel shader compile " << (capabilities.parallelShaderCompile ? "yes" : "no")
+            << ", program binary " << (capabilities.programBinary ? "yes" : "no")
+            << ", timer query " << (capabilities.timerQuery ? "yes" : "no") << std::endl;
     }
 
     void initAudio()
@@ -1181,22 +8052,125 @@ private:
             throw std::runtime_error("Failed to init OpenAL");
         }
 
-        audioContext = alcCreateContext(audioDevice, nullptr);
+        auto attributes = options.audio.getAttributes();
+        audioContext = alcCreateContext(audioDevice, attributes.data());
         if (!audioContext)
         {
             throw std::runtime_error("Failed to init OpenAL context");
         }
 
         alcMakeContextCurrent(audioContext);
+        AudioDeviceSettings actual = AudioDeviceSettings::query(audioDevice);
+        std::cout << "Audio device: " << actual.frequency << " Hz, " << actual.refresh << " updates/s" << std::endl;
+        std::cout << "Audio updates: " << (AudioBatch::isDeferred() ? "AL_SOFT_deferred_updates" : "context suspend") << std::endl;
+    }
+
+    // Decoding needs neither GL nor AL, this can start before either is initialized
+    void requestAssets()
+    {
+        loadStart = std::chrono::steady_clock::now();
+        shadersReported = false;
+
+        loader = std::make_unique<AssetLoader>();
+        assets.boxShader = loader->load<Shader>("shaders/box");
+        assets.spriteShader = loader->load<Shader>("shaders/sprite");
+        assets.powerUpShader = loader->load<Shader>("shaders/basic:INSTANCED");
+        assets.click = loader->load<AudioEntry>("audio/click.wav");
+        assets.gameOver = loader->load<AudioEntry>("audio/gameOver.aiff");
+    }
+
+    void beginLoading()
+    {
+        orthoMatrix = glm::ortho(-2.0f, 2.0f, -1.5f, 1.5f);
+
+        basicShader = ShaderCache::get().acquire(ShaderSource::load("shaders/basic"));
+        loadingBar = Ref<Quad>::make(Vec2{ 0.0f, 0.0f }, Vec2{ loadingBarWidth, 0.1f }, basicShader);
+
+        atlas.upload(uploader.get());
+        loading = true;
+    }
+
+    // Geometry falls back to main thread uploads when a shared context can't be created
+    void initUploader()
+    {
+        try
+        {
+            uploader = std::make_unique<GpuUploader>(window);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << e.what() << ", uploading on the main thread" << std::endl;
+        }
+    }
+
+    // Drops every cached source and program and goes back through the loading screen, the
+    // level restarts with the rebuilt shaders
+    void reloadShaders()
+    {
+        std::cout << "Reloading shaders" << std::endl;
+        ShaderPreprocessor::get().clear();
+        ShaderCache::get().clear();
+        requestAssets();
+        beginLoading();
+    }
+
+    // Finalizes a slice of the pending assets and draws the progress bar
+    void updateLoading()
+    {
+        if (glfwGetKey(window, GLFW_KEY_ESCAPE))
+        {
+            glfwSetWindowShouldClose(window, 1);
+        }
+
+        loader->pump(loadBudget);
+
+        float width = loadingBarWidth * std::max(loader->getProgress(), 0.01f);
+        loadingBar->resize(Vec2{ width, loadingBar->getSize().y });
+        loadingBar->setPosition(Vec2{ (width - loadingBarWidth) / 2.0f, 0.0f });
+        loadingBar->draw(orthoMatrix);
+
+        if (!shadersReported && assets.boxShader.isReady() && assets.spriteShader.isReady() && assets.powerUpShader.isReady())
+        {
+            shadersReported = true;
+            std::cout << "Shaders compiled in " << elapsedMs(loadStart) << " ms" << std::endl;
+        }
+
+        if (!loader->isIdle() || !atlas.isReady())
+        {
+            return;
+        }
+
+        if (!loader->getFailures().empty())
+        {
+            throw std::runtime_error("Failed to load asset: " + loader->getFailures().front());
+        }
+
+        // Workers are no longer needed, the handles keep the assets alive
+        loader.reset();
+        atlas.bind(0);
+        loading = false;
+        std::cout << "Assets loaded in " << elapsedMs(loadStart) << " ms" << std::endl;
 
-        gameOverEntry = Ref<AudioEntry>::make("audio/gameOver.aiff");
-        narrator = Ref<AudioSource>::make();
+        createResources();
     }
 
-    // Load assets
+    // Build the level from the loaded assets
     void createResources()
     {
-        player = Ref<PlayerPlatform>::make(Vec2{ 0.0f, -0.6f }, Vec2{ 0.4f, 0.05f });
+        if (!sounds.get())
+        {
+            sounds = Ref<SoundQueue>::make();
+            clickSound = sounds->add(assets.click.get());
+            gameOverSound = sounds->add(assets.gameOver.get(), 0.0);
+            if (!options.sampledHits)
+            {
+                auto synth = Ref<Synthesizer>::make();
+                std::cout << "Hit sounds: synthesized, " << (synth->usesCallback() ? "AL_SOFT_callback_buffer" : "streaming buffers") << std::endl;
+                sounds->setSynthesizer(synth);
+            }
+        }
+        player = Ref<PlayerPlatform>::make(Vec2{ 0.0f, -0.6f }, Vec2{ paddleWidth, 0.05f }, assets.spriteShader.get());
+        timers.clear();
 
         // Starting margin
         //  -2.0f + margin + xSize / 2, 1.5f - margin - ySize / 2
@@ -1209,6 +8183,8 @@ private:
         constexpr float ySize = xSize / 3;
 
         grid = Ref<BoxGrid>::make(
+            assets.boxShader.get(),
+            uploader.get(),
             Vec2{ -2.0f + margin + xSize / 2, 1.5f - margin - ySize / 2 }, 
             Vec2(xSize, ySize), 
             margin, 
@@ -1216,11 +8192,44 @@ private:
             gridY
         );
 
-        ball = Ref<Ball>::make(Vec2{ 0.0f, 0.0f }, Vec2{ 0.1f, 0.1f }, player, grid);
+        // Tougher bricks towards the top, two indestructible pillars at the bottom corners and a
+        // pair of explosive bricks in the lower rows
+        for (int y = 0; y < gridY; y++)
+        {
+            BrickMaterial material = y == 0 ? BrickMaterial::Armored : y < 3 ? BrickMaterial::Reinforced : BrickMaterial::Standard;
+            for (int x = 0; x < gridX; x++)
+            {
+                grid->setMaterial(static_cast<size_t>(y) * gridX + x, material);
+            }
+        }
+        grid->setMaterial(static_cast<size_t>(gridY - 1) * gridX, BrickMaterial::Indestructible);
+        grid->setMaterial(static_cast<size_t>(gridY) * gridX - 1, BrickMaterial::Indestructible);
+        grid->setMaterial(static_cast<size_t>(gridY - 3) * gridX + 2, BrickMaterial::Explosive);
+        grid->setMaterial(static_cast<size_t>(gridY - 3) * gridX + gridX - 3, BrickMaterial::Explosive);
+
+        if (!powerUps.get())
+        {
+            powerUps = Ref<PowerUpSystem>::make(assets.powerUpShader.get());
+        }
+        powerUps->setShader(assets.powerUpShader.get());
+        powerUps->clear();
+
+        for (size_t i = 0; i < maxBalls; i++)
+        {
+            balls[i] = Ref<Ball>::make(Vec2{ 0.0f, 0.0f }, Vec2{ 0.1f, 0.1f }, assets.spriteShader.get(), player, grid);
+            balls[i]->setActive(i == 0);
+        }
+        editor = std::make_unique<LevelEditor>(grid, Vec2(xSize, ySize));
 
         orthoMatrix = glm::ortho(-2.0f, 2.0f, -1.5f, 1.5f);
 
         gameOver = false;
+        score = 0;
+        events.clear();
+
+        ballSpeed = 1.5f;
+        scripts.clear();
+        scripts.start(runLevelScript());
     }
 
 };
@@ -1229,11 +8238,24 @@ private:
 // -------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------
-int main()
+int main(int argc, char** argv)
 {
     try
     {
-        auto app = std::make_unique<Application>(800, 600, "Arcanoid");
+        LaunchOptions options = LaunchOptions::parse(argc, argv);
+        if (options.benchmark)
+        {
+            runBenchmarks();
+            return 0;
+        }
+
+        if (options.audioProbe)
+        {
+            probeAudioLatency(options.audioProbeDevice.empty() ? nullptr : options.audioProbeDevice.c_str(), options.audio.frequency);
+            return 0;
+        }
+
+        auto app = std::make_unique<Application>(800, 600, "Arcanoid", options);
         return app->run();
     }
     catch (const std::runtime_error& e)
@@ -1248,6 +8270,6 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE, _In_ LPSTR, _In
 {
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 
-    return main();
+    return main(__argc, __argv);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,253 @@
+// Packs uncompressed TGA sprites into the layers of a texture array and writes a header with
+// the pixels and a constexpr region table, see SpriteAtlas in main.cpp.
+//
+//   atlas_packer <output header> <sprite.tga>...
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+
+using namespace std::string_literals;
+
+// -------------------------------------------------------------------------------------------
+constexpr uint32_t layerSize = 256;
+
+// Edge pixels are repeated into the gutter so the first mip levels don't bleed neighbours in
+constexpr uint32_t gutter = 4;
+constexpr uint32_t mipLevels = 3;
+
+struct Sprite
+{
+    std::string name;
+    uint32_t width{};
+    uint32_t height{};
+
+    // RGBA8, bottom row first like GL textures
+    std::vector<uint8_t> pixels;
+
+    uint32_t layer{};
+    uint32_t x{};
+    uint32_t y{};
+};
+
+// -------------------------------------------------------------------------------------------
+Sprite loadTga(const std::filesystem::path& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    uint8_t header[18] = {};
+    f.read(reinterpret_cast<char*>(header), sizeof(header));
+
+    uint8_t idLength = header[0];
+    uint8_t imageType = header[2];
+    uint32_t width = header[12] | (header[13] << 8);
+    uint32_t height = header[14] | (header[15] << 8);
+    uint8_t bitsPerPixel = header[16];
+    bool topOrigin = (header[17] & 0x20) != 0;
+
+    if (header[1] != 0 || imageType != 2 || (bitsPerPixel != 24 && bitsPerPixel != 32))
+    {
+        throw std::runtime_error(path.string() + ": only uncompressed 24 and 32 bit TGA is supported");
+    }
+    f.ignore(idLength);
+
+    uint32_t channels = bitsPerPixel / 8;
+    std::vector<uint8_t> data(static_cast<size_t>(width) * height * channels);
+    f.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!f)
+    {
+        throw std::runtime_error(path.string() + ": truncated pixel data");
+    }
+
+    Sprite sprite;
+    sprite.name = path.stem().string();
+    sprite.width = width;
+    sprite.height = height;
+    sprite.pixels.resize(static_cast<size_t>(width) * height * 4);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t row = topOrigin ? height - 1 - y : y;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const uint8_t* src = &data[(static_cast<size_t>(row) * width + x) * channels];
+            uint8_t* dst = &sprite.pixels[(static_cast<size_t>(y) * width + x) * 4];
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            dst[3] = channels == 4 ? src[3] : 255;
+        }
+    }
+    return sprite;
+}
+
+// Shelf packing, tallest sprites first. Returns the number of layers used.
+uint32_t pack(std::vector<Sprite>& sprites)
+{
+    std::vector<Sprite*> order;
+    for (auto& sprite : sprites)
+    {
+        if (sprite.width + 2 * gutter > layerSize || sprite.height + 2 * gutter > layerSize)
+        {
+            throw std::runtime_error(sprite.name + " does not fit into a " + std::to_string(layerSize) + " pixel layer");
+        }
+        order.push_back(&sprite);
+    }
+    std::sort(order.begin(), order.end(), [](const Sprite* a, const Sprite* b) { return a->height > b->height; });
+
+    uint32_t layer = 0;
+    uint32_t shelfY = 0;
+    uint32_t shelfHeight = 0;
+    uint32_t cursorX = 0;
+    for (Sprite* sprite : order)
+    {
+        uint32_t width = sprite->width + 2 * gutter;
+        uint32_t height = sprite->height + 2 * gutter;
+        if (cursorX + width > layerSize)
+        {
+            shelfY += shelfHeight;
+            shelfHeight = 0;
+            cursorX = 0;
+        }
+        if (shelfY + height > layerSize)
+        {
+            layer++;
+            shelfY = 0;
+            shelfHeight = 0;
+            cursorX = 0;
+        }
+
+        sprite->layer = layer;
+        sprite->x = cursorX + gutter;
+        sprite->y = shelfY + gutter;
+        cursorX += width;
+        shelfHeight = std::max(shelfHeight, height);
+    }
+    return sprites.empty() ? 0 : layer + 1;
+}
+
+std::vector<uint8_t> compose(const std::vector<Sprite>& sprites, uint32_t layerCount)
+{
+    std::vector<uint8_t> atlas(static_cast<size_t>(layerSize) * layerSize * 4 * layerCount, 0);
+    for (const auto& sprite : sprites)
+    {
+        int width = static_cast<int>(sprite.width);
+        int height = static_cast<int>(sprite.height);
+        for (int y = -static_cast<int>(gutter); y < height + static_cast<int>(gutter); y++)
+        {
+            for (int x = -static_cast<int>(gutter); x < width + static_cast<int>(gutter); x++)
+            {
+                int srcX = std::clamp(x, 0, width - 1);
+                int srcY = std::clamp(y, 0, height - 1);
+                size_t dstX = sprite.x + x;
+                size_t dstY = sprite.y + y;
+
+                const uint8_t* src = &sprite.pixels[(static_cast<size_t>(srcY) * width + srcX) * 4];
+                uint8_t* dst = &atlas[((static_cast<size_t>(sprite.layer) * layerSize + dstY) * layerSize + dstX) * 4];
+                std::copy(src, src + 4, dst);
+            }
+        }
+    }
+    return atlas;
+}
+
+void writeHeader(const std::filesystem::path& path, const std::vector<Sprite>& sprites, uint32_t layerCount, const std::vector<uint8_t>& atlas)
+{
+    std::ostringstream out;
+    out << "// Generated by tools/AtlasPacker.cpp from res/sprites, do not edit\n"
+        << "#pragma once\n\n"
+        << "#include <array>\n"
+        << "#include <cstdint>\n"
+        << "#include <string_view>\n\n"
+        << "struct AtlasRegion\n"
+        << "{\n"
+        << "    std::string_view name;\n"
+        << "    uint32_t layer;\n"
+        << "    float u0, v0, u1, v1;\n"
+        << "};\n\n"
+        << "inline constexpr uint32_t atlasLayerSize = " << layerSize << ";\n"
+        << "inline constexpr uint32_t atlasLayerCount = " << layerCount << ";\n"
+        << "inline constexpr uint32_t atlasMipLevels = " << mipLevels << ";\n\n"
+        << "inline constexpr std::array<AtlasRegion, " << sprites.size() << "> atlasRegions =\n"
+        << "{\n";
+
+    auto uv = [](uint32_t texel) { return std::to_string(static_cast<float>(texel) / layerSize) + "f"; };
+    for (const auto& sprite : sprites)
+    {
+        out << "    AtlasRegion{ \"" << sprite.name << "\", " << sprite.layer << ", "
+            << uv(sprite.x) << ", " << uv(sprite.y) << ", "
+            << uv(sprite.x + sprite.width) << ", " << uv(sprite.y + sprite.height) << " },\n";
+    }
+
+    out << "};\n\n"
+        << "constexpr const AtlasRegion* findAtlasRegion(std::string_view name)\n"
+        << "{\n"
+        << "    for (const auto& region : atlasRegions)\n"
+        << "    {\n"
+        << "        if (region.name == name)\n"
+        << "        {\n"
+        << "            return &region;\n"
+        << "        }\n"
+        << "    }\n"
+        << "    return nullptr;\n"
+        << "}\n\n"
+        << "// RGBA8, layer after layer, bottom row first\n"
+        << "inline constexpr std::array<uint8_t, " << atlas.size() << "> atlasPixels =\n"
+        << "{";
+
+    for (size_t i = 0; i < atlas.size(); i++)
+    {
+        out << (i % 32 == 0 ? "\n    " : "") << static_cast<unsigned>(atlas[i]) << ",";
+    }
+    out << "\n};\n";
+
+    std::ofstream f(path, std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+    f << out.str();
+}
+
+// -------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: atlas_packer <output header> <sprite.tga>..." << std::endl;
+        return -1;
+    }
+
+    try
+    {
+        std::vector<Sprite> sprites;
+        for (int i = 2; i < argc; i++)
+        {
+            sprites.push_back(loadTga(argv[i]));
+        }
+
+        // Stable output regardless of the order the build system lists the files in
+        std::sort(sprites.begin(), sprites.end(), [](const Sprite& a, const Sprite& b) { return a.name < b.name; });
+
+        uint32_t layerCount = pack(sprites);
+        writeHeader(argv[1], sprites, layerCount, compose(sprites, layerCount));
+
+        std::cout << "Packed " << sprites.size() << " sprites into " << layerCount << " layer(s)" << std::endl;
+        return 0;
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return -1;
+    }
+}